@@ -0,0 +1,305 @@
+/*
+*    TextSoup, Yet another text editor
+*    Copyright (C) 2017  Jyry Hjelt
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*/
+// batch.cpp
+
+// Include the libraries
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "batch.hpp"
+#include "buffer.hpp"
+#include "files.hpp"
+#include "logging.hpp"
+#include "pool.hpp"
+#include "search.hpp"
+
+using namespace std;
+
+namespace {
+
+// Split "/OLD/NEW/" at its delimiters
+bool splitReplace(const string& arg, string& text, string& with)
+{
+    if (arg.length() < 3) {
+        return false;
+    }
+    char d = arg[0];
+    size_t middle = arg.find(d, 1);
+    if (middle == string::npos || arg.back() != d || middle + 1 > arg.length() - 1) {
+        return false;
+    }
+    text = arg.substr(1, middle - 1);
+    with = arg.substr(middle + 1, arg.length() - middle - 2);
+    return !text.empty();
+}
+
+// Find the next match of c from line y, column x on
+bool findFrom(const TextBuffer& buffer, const Command& c, size_t& y, size_t x)
+{
+    unique_ptr<Regex::Matcher> matcher;
+    if (c.pattern) {
+        matcher.reset(new Regex::Matcher(c.pattern->matcher()));
+    }
+    vector<size_t> starts;
+    for (; y < buffer.size(); y++, x = 0) {
+        LineView line = buffer.view(y);
+        if (x > line.size) {
+            continue;
+        }
+        if (matcher) {
+            starts.clear();
+            matcher->findStarts(line, starts);
+            for (size_t start : starts) {
+                if (start >= x)
+                    return true;
+            }
+        } else if (findNext(line.data + x, line.data + line.size, c.text.data(), c.text.length())) {
+            return true;
+        }
+    }
+    return false;
+}
+
+string where(const Command& c)
+{
+    return "line " + to_string(c.line) + " of the script: ";
+}
+} // namespace
+
+bool parseScript(const string& name, vector<Command>& script, string& error)
+{
+    ifstream in(name.c_str());
+    if (!in) {
+        error = "Can't read the script " + name;
+        return false;
+    }
+
+    string text;
+    for (size_t n = 1; getline(in, text); n++) {
+        if (!text.empty() && text.back() == '\r') {
+            text.pop_back();
+        }
+        size_t start = text.find_first_not_of(" \t");
+        if (start == string::npos || text[start] == '#') {
+            continue;
+        }
+        size_t space = text.find(' ', start);
+        string word = text.substr(start, space - start);
+        string arg = space == string::npos ? "" : text.substr(space + 1);
+
+        Command c;
+        c.line = n;
+        c.regex = word == "find-regex" || word == "replace-regex";
+        if (word == "goto") {
+            c.kind = Command::TO_LINE;
+            if (arg.empty() || arg.find_first_not_of("0123456789") != string::npos) {
+                error = where(c) + "goto needs a line number";
+                return false;
+            }
+            c.count = strtoull(arg.c_str(), nullptr, 10);
+        } else if (word == "find" || word == "find-regex") {
+            c.kind = Command::FIND_TEXT;
+            c.text = arg;
+        } else if (word == "replace" || word == "replace-regex") {
+            c.kind = Command::REPLACE_TEXT;
+            if (!splitReplace(arg, c.text, c.with)) {
+                error = where(c) + word + " needs /OLD/NEW/";
+                return false;
+            }
+        } else if (word == "insert" || word == "append") {
+            c.kind = word == "insert" ? Command::INSERT_LINE : Command::APPEND_LINE;
+            c.text = arg;
+        } else if (word == "delete") {
+            c.kind = Command::DELETE_LINES;
+            c.count = arg.empty() ? 1 : strtoull(arg.c_str(), nullptr, 10);
+            if (c.count == 0) {
+                error = where(c) + "delete needs a number of lines";
+                return false;
+            }
+        } else {
+            error = where(c) + "unknown command " + word;
+            return false;
+        }
+
+        if (c.kind == Command::FIND_TEXT && c.text.empty()) {
+            error = where(c) + word + " needs something to find";
+            return false;
+        }
+        if (c.regex) {
+            string why;
+            c.pattern = Regex::compile(c.text, why);
+            if (!c.pattern) {
+                error = where(c) + why;
+                return false;
+            }
+        }
+        script.push_back(move(c));
+    }
+    return true;
+}
+
+BatchResult runScript(const vector<Command>& script, const string& name)
+{
+    BatchResult result;
+    TextBuffer buffer;
+
+    // Loaded like loadFile() does it, without its log entries
+    string file = name;
+    shared_ptr<MappedFile> mapping = make_shared<MappedFile>(file);
+    if (mapping->good()) {
+        buffer.assign(mapping);
+        buffer.indexAll();
+    } else if (fileExists(file)) {
+        buffer.assign(getFileLines(file));
+    } else {
+        result.error = "can't read it";
+        return result;
+    }
+
+    size_t y = 0, x = 0; // Where the last find found something
+    for (const Command& c : script) {
+        size_t before = buffer.version();
+        switch (c.kind) {
+        case Command::TO_LINE:
+            y = c.count == 0 ? buffer.size() - 1 : c.count - 1;
+            x = 0;
+            if (c.count > buffer.size() || buffer.size() == 0) {
+                result.error = where(c) + "there is no line " + to_string(c.count);
+                return result;
+            }
+            break;
+        case Command::FIND_TEXT:
+            // The first find may find something on the first line
+            if (!findFrom(buffer, c, y, x)) {
+                result.error = where(c) + "didn't find " + c.text;
+                return result;
+            }
+            x = buffer.view(y).size + 1; // The next one starts on the next line
+            break;
+        case Command::REPLACE_TEXT: {
+            Replacement undo;
+            string error;
+            replaceAll(buffer, c.text, c.with, c.regex, undo, error);
+            break;
+        }
+        case Command::INSERT_LINE:
+            buffer.insertLine(min(y, buffer.size()), c.text);
+            x = 0;
+            break;
+        case Command::APPEND_LINE:
+            y = min(y + 1, buffer.size());
+            buffer.insertLine(y, c.text);
+            x = 0;
+            break;
+        case Command::DELETE_LINES:
+            if (y + c.count > buffer.size()) {
+                result.error = where(c) + "there aren't " + to_string(c.count) + " lines to delete";
+                return result;
+            }
+            for (size_t i = 0; i < c.count; i++) {
+                buffer.eraseLine(y);
+            }
+            x = 0;
+            break;
+        }
+        if (buffer.version() != before) {
+            result.edits++;
+        }
+    }
+
+    result.ok = true;
+    if (buffer.modified()) {
+        if (writesInPlace(file)) {
+            buffer.unmap(); // It would be read while it's written over
+        }
+        SaveStats stats = writeToFile(file, buffer);
+        result.ok = stats.ok;
+        result.changed = stats.ok;
+        result.error = stats.error;
+    }
+    return result;
+}
+
+int runBatch(const string& scriptName, const vector<string>& files)
+{
+    vector<Command> script;
+    string error;
+    if (!parseScript(scriptName, script, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return EXIT_FAILURE;
+    }
+
+    // The files are handed out one at a time, to the pool's workers and
+    // this thread, so a big file doesn't hold up the rest
+    struct Job {
+        vector<Command> script;
+        vector<string> files;
+        vector<BatchResult> results;
+        atomic<size_t> next{ 0 }, done{ 0 };
+    };
+    shared_ptr<Job> job = make_shared<Job>();
+    job->script = move(script);
+    job->files = files;
+    job->results.resize(files.size());
+
+    auto start = chrono::steady_clock::now();
+    auto work = [job]() {
+        size_t i;
+        while ((i = job->next.fetch_add(1)) < job->files.size()) {
+            job->results[i] = runScript(job->script, job->files[i]);
+            job->done.fetch_add(1, memory_order_release);
+        }
+    };
+    size_t helpers = files.empty() ? 0 : min(sharedPool().size(), files.size()) - 1;
+    for (size_t i = 0; i < helpers; i++) {
+        sharedPool().submit(work);
+    }
+    work();
+    while (job->done.load(memory_order_acquire) < files.size()) {
+        this_thread::yield();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    size_t changed = 0, failed = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+        const BatchResult& r = job->results[i];
+        if (!r.ok) {
+            failed++;
+            printf("failed    %s: %s\n", files[i].c_str(), r.error.c_str());
+        } else if (r.changed) {
+            changed++;
+            printf("changed   %s (%zu edits)\n", files[i].c_str(), r.edits);
+        } else {
+            printf("unchanged %s\n", files[i].c_str());
+        }
+    }
+
+    char summary[160];
+    snprintf(summary, sizeof(summary),
+        "%zu file%s in %.3f s (%.0f files/s): %zu changed, %zu unchanged, %zu failed",
+        files.size(), files.size() == 1 ? "" : "s", seconds, seconds > 0 ? files.size() / seconds : 0.0, changed,
+        files.size() - changed - failed, failed);
+    printf("%s\n", summary);
+    Logging::logEntry("Ran " + scriptName + " on " + summary, Logging::NOTE);
+    return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,64 @@
+// batch.hpp
+#ifndef BATCH_H
+#define BATCH_H
+
+// Editing files without a terminal: soup --exec script file...
+//
+// A script has a command on every line, blank lines and lines starting with
+// # are skipped. Every file has a current line, the first one at the start.
+//
+//   goto N              Line N is the current one (1 is the first, 0 the last)
+//   find TEXT           The next line with TEXT in it is the current one, from
+//                       the current line on (after it if a find went there)
+//   find-regex PATTERN  The same with a regular expression (see regex.hpp)
+//   replace /OLD/NEW/   Replace every OLD in the file with NEW, any character
+//                       that isn't in them can be used instead of /
+//   replace-regex /PATTERN/NEW/
+//   insert TEXT         Add a line before the current one, it's the current one
+//   append TEXT         Add a line after the current one, it's the current one
+//   delete [N]          Delete N lines from the current one on (1 by default)
+//
+// A find that finds nothing or a line that isn't there fails the file, it's
+// left as it was. Files that changed are saved at the end.
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "regex.hpp"
+
+using namespace std;
+
+struct Command {
+    enum Kind { TO_LINE,
+        FIND_TEXT,
+        REPLACE_TEXT,
+        INSERT_LINE,
+        APPEND_LINE,
+        DELETE_LINES } kind;
+    bool regex = false;
+    string text; // What is looked for or put in
+    string with; // What a replace puts in
+    size_t count = 0; // Line of a goto, lines of a delete
+    size_t line = 0; // Where it is in the script
+    shared_ptr<const Regex> pattern; // Compiled once for every file
+};
+
+// What happened to a file
+struct BatchResult {
+    bool ok = false;
+    bool changed = false; // Saved with changes
+    size_t edits = 0; // Commands that changed something
+    string error; // Why it failed
+};
+
+// Read a script, false and why if it's broken
+bool parseScript(const string& name, vector<Command>& script, string& error);
+
+// Run a script on one file and save it if it changed
+BatchResult runScript(const vector<Command>& script, const string& name);
+
+// Run a script on every file on the thread pool, print how every file went
+// and how fast it was. Gives the exit status.
+int runBatch(const string& scriptName, const vector<string>& files);
+
+#endif // BATCH_H
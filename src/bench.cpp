@@ -0,0 +1,267 @@
+/*
+*    TextSoup, Yet another text editor
+*    Copyright (C) 2017  Jyry Hjelt
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*/
+// bench.cpp
+
+// Latency benchmark for the editor, run with 'make bench'
+//
+// Generates files of different sizes, replays scripts of keys against them
+// on a HeadlessTerminal and prints how long the editor took per key. Pass
+// line counts as arguments to choose the file sizes.
+
+// Include the libraries
+#include <algorithm>
+#include <chrono>
+#include <ncurses.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "buffer.hpp"
+#include "editor.h"
+#include "logging.hpp"
+#include "search.hpp"
+#include "terminal.hpp"
+
+using namespace std;
+
+// A list of keys to replay. The setup keys aren't timed.
+struct Script {
+    string name;
+    vector<int> setup;
+    vector<int> keys;
+    vector<string> pastes; // Text of the KEY_PASTEs
+};
+
+void addText(vector<int>& keys, const string& text)
+{
+    keys.insert(keys.end(), text.begin(), text.end());
+}
+
+void addKey(vector<int>& keys, int key, size_t times)
+{
+    keys.insert(keys.end(), times, key);
+}
+
+// Write a file of lines that look a bit like a log
+void generate(const string& path, size_t lines)
+{
+    static const char* words[] = { "GET", "POST", "user", "session", "timeout",
+        "cache", "miss", "ok", "retry", "upstream", "db", "query" };
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) {
+        perror(path.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned int seed = 12345;
+    for (size_t i = 0; i < lines; i++) {
+        seed = seed * 1103515245 + 12345;
+        fprintf(f, "line %zu req-%06x", i, seed & 0xffffff);
+        for (unsigned int w = 0; w < (seed >> 16) % 8; w++) {
+            fprintf(f, " %s", words[(seed >> (w + 3)) % 12]);
+        }
+        fputc('\n', f);
+    }
+    fclose(f);
+}
+
+vector<Script> scripts(size_t lines)
+{
+    vector<Script> all;
+    Script s;
+
+    // Typing in the middle of the screen
+    s = Script();
+    s.name = "type";
+    addKey(s.setup, KEY_DOWN, 20);
+    for (int i = 0; i < 100; i++)
+        addText(s.keys, "the quick brown fox ");
+    all.push_back(s);
+
+    // Splitting a line over and over
+    s = Script();
+    s.name = "enter";
+    addKey(s.setup, KEY_DOWN, 20);
+    addKey(s.keys, ENTER, 1000);
+    all.push_back(s);
+
+    // Joining the lines back with backspace at the start of the line
+    s = Script();
+    s.name = "join";
+    addKey(s.setup, KEY_DOWN, 20);
+    addKey(s.setup, ENTER, 1000);
+    addKey(s.keys, KEY_BACKSPACE, 1000);
+    all.push_back(s);
+
+    // Pasting 100 KB of lines
+    s = Script();
+    s.name = "paste";
+    addKey(s.setup, KEY_DOWN, 20);
+    s.keys.push_back(KEY_PASTE);
+    string text;
+    for (int i = 0; text.length() < 100000; i++)
+        text += "    pasted line " + to_string(i) + " with some text\r";
+    s.pastes.push_back(text);
+    all.push_back(s);
+
+    // Typing a query and stepping through the hits
+    s = Script();
+    s.name = "find";
+    s.keys.push_back(F);
+    addText(s.keys, "line " + to_string(lines * 3 / 4));
+    addKey(s.keys, KEY_DOWN, 20);
+    addKey(s.keys, KEY_UP, 20);
+    s.keys.push_back(ENTER);
+    all.push_back(s);
+
+    // The same with a regular expression
+    s = Script();
+    s.name = "regex";
+    s.keys.push_back(F);
+    s.keys.push_back(E);
+    addText(s.keys, "req-[0-9a-f]{4}ff");
+    addKey(s.keys, KEY_DOWN, 20);
+    s.keys.push_back(ENTER);
+    all.push_back(s);
+
+    // Replacing a couple of hits one by one, then every one and undoing it
+    s = Script();
+    s.name = "replace";
+    s.keys.push_back(R);
+    addText(s.keys, "session");
+    s.keys.push_back(ENTER);
+    addText(s.keys, "SESSION");
+    s.keys.push_back(ENTER);
+    addKey(s.keys, 'y', 5);
+    s.keys.push_back('a');
+    s.keys.push_back(Z);
+    all.push_back(s);
+
+    // Saving, the total includes waiting for the save to finish
+    s = Script();
+    s.name = "save";
+    s.keys.push_back('x');
+    s.keys.push_back(S);
+    s.keys.push_back(ENTER);
+    all.push_back(s);
+
+    return all;
+}
+
+// The replace script times the fast path, a replace that gets the text
+// wrong shouldn't pass for fast. Patterns that match nothing are the easy
+// ones to get wrong, and a line longer than a fresh arena chunk has to fit.
+bool checkReplace()
+{
+    struct Case {
+        const char* query;
+        bool regex;
+        vector<string> before, after;
+    };
+    const Case cases[] = {
+        { "session", false, { "a session, session", "none" }, { "a X, X", "none" } },
+        { "a*", true, { "baaa", "xyz", "aab" }, { "bX", "xyz", "Xb" } },
+        { "a*c", true, { "caac" }, { "XX" } },
+        { "q*", true, { "abc" }, { "abc" } },
+        { "session", false, { string(5000, 'y') + " session" }, { string(5000, 'y') + " X" } },
+    };
+    for (const Case& c : cases) {
+        TextBuffer buffer;
+        buffer.assign(c.before);
+        Replacement undo;
+        string error;
+        replaceAll(buffer, c.query, "X", c.regex, undo, error);
+        if (!buffer.equals(c.after)) {
+            fprintf(stderr, "Replacing %s with X gives the wrong text\n", c.query);
+            return false;
+        }
+    }
+    return true;
+}
+
+double percentile(const vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t i = min(sorted.size() - 1, size_t(sorted.size() * p));
+    return sorted[i];
+}
+
+int main(int count, char* option[])
+{
+    Logging::setMinLevel(Logging::FATAL); // Keep the log clean
+    if (!checkReplace()) {
+        return EXIT_FAILURE;
+    }
+
+    vector<size_t> sizes;
+    for (int i = 1; i < count; i++) {
+        sizes.push_back(strtoull(option[i], nullptr, 10));
+    }
+    if (sizes.empty()) {
+        sizes = { 1000, 100000, 1000000, 10000000 };
+    }
+
+    char dir[] = "/tmp/soup-bench-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    typedef chrono::steady_clock Clock;
+    HeadlessTerminal terminal(50, 160);
+
+    printf("%10s %-6s %6s %10s %10s %10s %10s %9s %10s\n", "lines", "script", "keys",
+        "p50 (us)", "p99 (us)", "max (us)", "keys/s", "open (ms)", "total (ms)");
+    for (size_t lines : sizes) {
+        string path = string(dir) + "/bench-" + to_string(lines) + ".txt";
+        generate(path, lines);
+
+        for (const Script& script : scripts(lines)) {
+            Clock::time_point start = Clock::now();
+            loadEditor(path);
+            double open = chrono::duration<double>(Clock::now() - start).count();
+
+            // Quit without saving when the script is done
+            vector<int> keys = script.setup;
+            keys.insert(keys.end(), script.keys.begin(), script.keys.end());
+            keys.push_back(Q);
+            keys.push_back('n');
+            terminal.play(keys, script.setup.size(), script.pastes);
+            runEditor(terminal);
+            double total = chrono::duration<double>(Clock::now() - start).count();
+
+            vector<double> times = terminal.latencies;
+            times.resize(min(times.size(), script.keys.size()));
+            double sum = 0;
+            for (double t : times)
+                sum += t;
+            sort(times.begin(), times.end());
+
+            printf("%10zu %-6s %6zu %10.1f %10.1f %10.1f %10.0f %9.1f %10.1f\n", lines,
+                script.name.c_str(), times.size(), percentile(times, 0.5) * 1e6,
+                percentile(times, 0.99) * 1e6, times.empty() ? 0 : times.back() * 1e6,
+                sum > 0 ? times.size() / sum : 0, open * 1e3, total * 1e3);
+            fflush(stdout);
+        }
+        unlink(path.c_str());
+    }
+
+    loadEditor(""); // Let go of the last file before removing it
+    rmdir(dir);
+    return 0;
+}
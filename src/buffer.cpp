@@ -0,0 +1,1057 @@
+/*
+*    TextSoup, Yet another text editor
+*    Copyright (C) 2017  Jyry Hjelt
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*/
+// buffer.cpp
+
+// Include the libraries
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "buffer.hpp"
+#include "files.hpp"
+#include "lineindex.hpp"
+#include "pool.hpp"
+#include "utf8.hpp"
+
+using namespace std;
+
+// An empty line with its newline, for the line of a new buffer
+const char blank[] = "\n";
+
+// Mappings smaller than this are split right away, it's quicker than starting
+// a thread to count their lines
+const size_t COUNT_MIN = 256 << 10;
+
+// Line hashes are joined modulo a prime. Modulo 2^64 some long runs of two
+// different lines could be shuffled without the hash changing.
+const uint64_t HASH_PRIME = (1ull << 61) - 1;
+const uint64_t HASH_BASE = 0x1d8e4e27c47d124full % HASH_PRIME;
+
+// Passing one to a const reference (make_shared(), min()) needs them defined
+const size_t TextBuffer::LEAF_MAX;
+const size_t TextBuffer::LEAF_FILL;
+
+// Chunks of line text, each line followed by a newline like in a file so
+// the lines that are next to each other are saved in one write. Chunks are
+// only ever added, text never moves, so the lines of copies of the buffer
+// on other threads stay good. The chunks grow up to a megabyte, a line
+// bigger than a quarter of that gets its own.
+struct TextBuffer::Arena {
+    vector<unique_ptr<char[]>> chunks;
+    char* free = nullptr; // Where the next line goes
+    size_t left = 0; // Bytes left at free
+    size_t bytes = 0; // Bytes in all the chunks
+
+    const char* add(const char* data, size_t n)
+    {
+        const size_t MAX_CHUNK = 1 << 20;
+        char* at;
+        if (n + 1 > MAX_CHUNK / 4) {
+            chunks.emplace_back(new char[n + 1]);
+            bytes += n + 1;
+            at = chunks.back().get();
+        } else {
+            if (left < n + 1) {
+                size_t size = max(n + 1, min(MAX_CHUNK, max(size_t(4096), bytes)));
+                chunks.emplace_back(new char[size]);
+                bytes += size;
+                free = chunks.back().get();
+                left = size;
+            }
+            at = free;
+            free += n + 1;
+            left -= n + 1;
+        }
+        memcpy(at, data, n);
+        at[n] = '\n';
+        return at;
+    }
+};
+
+TextBuffer::TextBuffer()
+{
+    Line l;
+    l.data = blank;
+    l.hash = hashLine(blank, 0);
+    root = newLeaf(vector<Line>(1, l));
+}
+
+// Replace the contents of the buffer with the given lines
+void TextBuffer::assign(vector<string> lines)
+{
+    root.reset();
+    arena.reset();
+    mapping.reset();
+    offsets.reset();
+    indexed = 0;
+    indexedLines = 0;
+    lexed = 0;
+    generation++;
+
+    // Cut the lines into leaves and append them one by one
+    for (size_t i = 0; i < lines.size(); i += LEAF_FILL) {
+        size_t end = min(lines.size(), i + LEAF_FILL);
+        vector<Line> chunk;
+        chunk.reserve(end - i);
+        for (size_t j = i; j < end; j++) {
+            chunk.push_back(storedLine(lines[j].data(), lines[j].length()));
+        }
+        root = merge(move(root), newLeaf(move(chunk)));
+    }
+    markSaved(); // A freshly loaded buffer has nothing to save
+}
+
+// Replace the contents of the buffer with a mapped file. Unless the file is
+// small nothing is read yet, the lines get split out as they are needed.
+void TextBuffer::assign(shared_ptr<MappedFile> file)
+{
+    root.reset();
+    arena.reset();
+    mapping = move(file);
+    indexed = 0;
+    indexedLines = 0;
+    lexed = 0;
+    offsets.reset();
+    generation++;
+    markSaved(); // Nothing is indexed yet, the saved hash follows the indexing
+
+    if (mapping->size() < COUNT_MIN) {
+        indexAll();
+    } else {
+        offsets = make_shared<LineIndex>(mapping, LEAF_FILL);
+    }
+}
+
+void TextBuffer::unmap()
+{
+    if (!mapping) {
+        return;
+    }
+    indexAll();
+    unmap(root);
+    if (savedIndexed == indexed) {
+        savedIndexed = 0;
+    }
+    mapping.reset();
+    offsets.reset();
+    indexed = 0;
+    indexedLines = 0;
+}
+
+size_t TextBuffer::size() const
+{
+    return root ? root->count : 0;
+}
+
+bool TextBuffer::complete() const
+{
+    return !mapping || indexed >= mapping->size();
+}
+
+size_t TextBuffer::lineCount() const
+{
+    if (complete() || !offsets)
+        return size();
+    // The lines past the indexed ones are as many as the index has counted
+    return size() + max(offsets->lines(), indexedLines) - indexedLines;
+}
+
+bool TextBuffer::counted() const
+{
+    return complete() || !offsets || offsets->done();
+}
+
+void TextBuffer::indexTo(size_t y)
+{
+    if (size() < y && !complete()) {
+        indexLeaves((y - size() + LEAF_FILL - 1) / LEAF_FILL);
+    }
+}
+
+void TextBuffer::indexAll()
+{
+    if (!complete()) {
+        indexLeaves(SIZE_MAX);
+    }
+}
+
+LineView TextBuffer::tail() const
+{
+    if (complete())
+        return LineView{ nullptr, 0, 0, false, false };
+    return LineView{ mapping->data() + indexed, mapping->size() - indexed, 0, false, false };
+}
+
+void TextBuffer::forEachRun(const function<void(const char*, size_t)>& f) const
+{
+    static const char newline = '\n';
+    const char* run = nullptr; // Mapped or arena bytes waiting to be handed out
+    size_t runLength = 0;
+    const char* indexedEnd = mapping ? mapping->data() + indexed : nullptr;
+
+    auto flush = [&]() {
+        if (runLength > 0)
+            f(run, runLength);
+        runLength = 0;
+    };
+
+    auto walk = [&](const Line& l) {
+        if (l.text) {
+            flush();
+            f(l.text->data(), l.text->length());
+            f(&newline, 1);
+            return;
+        }
+
+        // A line in the arena is always followed by its newline, a mapped
+        // one unless it is the last line of a file that doesn't end in one
+        bool mapped = mapping && l.data >= mapping->data() && l.data <= mapping->data() + mapping->size();
+        bool hasNewline = !mapped || l.data + l.length < indexedEnd;
+        if (runLength == 0 || run + runLength != l.data) {
+            flush();
+            run = l.data;
+        }
+        runLength += l.length + (hasNewline ? 1 : 0);
+        if (!hasNewline) {
+            flush();
+            f(&newline, 1);
+        }
+    };
+    forEachLine(root.get(), walk);
+
+    // The rest of the file goes out as it is
+    LineView rest = tail();
+    if (rest.size > 0) {
+        if (runLength == 0 || run + runLength != rest.data) {
+            flush();
+            run = rest.data;
+        }
+        runLength += rest.size;
+        flush();
+        if (rest.data[rest.size - 1] != '\n')
+            f(&newline, 1);
+    }
+    flush();
+}
+
+string TextBuffer::line(size_t y) const
+{
+    size_t leaf, local;
+    Node* t = locate(y, leaf, local);
+    const Line& l = t->lines[local];
+    if (l.text)
+        return *l.text;
+    return string(l.data, l.length);
+}
+
+LineView TextBuffer::view(size_t y) const
+{
+    size_t leaf, local;
+    Node* t = locate(y, leaf, local);
+    return t->lines[local].view();
+}
+
+size_t TextBuffer::length(size_t y) const
+{
+    size_t leaf, local;
+    Node* t = locate(y, leaf, local);
+    return t->lines[local].view().size;
+}
+
+// Compare the buffer line-by-line with a vector of lines
+bool TextBuffer::equals(const vector<string>& lines)
+{
+    indexAll();
+    if (lines.size() != size()) {
+        return false;
+    }
+    bool same = true;
+    forEach(0, size(), [&](size_t y, LineView v) {
+        const string& l = lines[y];
+        if (same && (l.length() != v.size || l.compare(0, v.size, v.data, v.size) != 0))
+            same = false;
+    });
+    return same;
+}
+
+bool TextBuffer::modified() const
+{
+    if (generation == savedGeneration) {
+        return false;
+    }
+    // Edits that were undone by hand leave the same lines in the same order
+    uint64_t hash = root ? root->hash : 0;
+    return savedIndexed != indexed || savedLines != size() || savedHash != hash;
+}
+
+void TextBuffer::markSaved()
+{
+    savedGeneration = generation;
+    savedHash = root ? root->hash : 0;
+    savedLines = size();
+    savedIndexed = indexed;
+}
+
+void TextBuffer::markSaved(const TextBuffer& snapshot)
+{
+    savedGeneration = snapshot.generation;
+    if (snapshot.mapping == mapping && snapshot.indexed == indexed) {
+        savedHash = snapshot.root ? snapshot.root->hash : 0;
+        savedLines = snapshot.size();
+        savedIndexed = indexed;
+    } else {
+        savedIndexed = SIZE_MAX; // Indexed since, only the generation tells
+    }
+}
+
+void TextBuffer::insertChar(size_t y, size_t x, char c)
+{
+    Line& l = edit(y);
+    l.text->insert(l.text->begin() + x, c);
+    edited(y, l);
+    if (listener) {
+        listener->inserted(y, x, &c, 1);
+    }
+}
+
+void TextBuffer::insertText(size_t y, size_t x, const string& text)
+{
+    Line& l = edit(y);
+    l.text->insert(x, text);
+    edited(y, l);
+    if (listener) {
+        listener->inserted(y, x, text.data(), text.length());
+    }
+}
+
+void TextBuffer::erase(size_t y, size_t x, size_t n)
+{
+    Line& l = edit(y);
+    n = min(n, l.text->length() - x);
+    l.text->erase(x, n);
+    edited(y, l);
+    if (listener) {
+        listener->erased(y, x, n);
+    }
+}
+
+void TextBuffer::setLine(size_t y, const string& text)
+{
+    Line& l = edit(y);
+    *l.text = text;
+    edited(y, l);
+    if (listener) {
+        listener->lineSet(y, text);
+    }
+}
+
+void TextBuffer::setLines(vector<pair<size_t, string>> lines)
+{
+    if (lines.empty()) {
+        return;
+    }
+    if (listener) {
+        for (const pair<size_t, string>& l : lines) {
+            listener->lineSet(l.first, l.second);
+        }
+    }
+    lexed = min(lexed, lines.front().first);
+    size_t at = 0;
+    setLines(root, 0, lines, at);
+    generation++;
+}
+
+void TextBuffer::insertLine(size_t y, const string& text)
+{
+    if (listener) {
+        listener->linesInserted(y, vector<string>(1, text));
+    }
+    generation++;
+
+    // An empty buffer gets a fresh leaf
+    if (!root) {
+        root = newLeaf(vector<Line>(1, storedLine(text.data(), text.length())));
+        return;
+    }
+
+    size_t leaf, local;
+    vector<Node*> path;
+    Node* t = modify(y, leaf, local, path);
+    t->lines.insert(t->lines.begin() + local, storedLine(text.data(), text.length()));
+    rehash(t);
+    recount(path);
+
+    if (t->lines.size() > LEAF_MAX) {
+        rebalanceLeaf(leaf);
+    }
+    restale(y + 1); // Follows another line now
+    lexed = min(lexed, y);
+}
+
+// New leaves of lines are merged in between the leaves, so a big paste costs
+// O(lines + log n) instead of an insert and a rebalance per line
+void TextBuffer::insertLines(size_t y, vector<string> texts)
+{
+    if (texts.empty()) {
+        return;
+    }
+    if (listener) {
+        listener->linesInserted(y, texts);
+    }
+
+    size_t count = texts.size();
+    vector<Line> fresh;
+    fresh.reserve(count);
+    for (const string& text : texts) {
+        fresh.push_back(storedLine(text.data(), text.length()));
+    }
+    generation++;
+
+    // Cut the leaf holding line y in two so the new leaves go in between
+    size_t at = 0;
+    if (root) {
+        size_t leaf, local;
+        vector<Node*> path;
+        Node* t = modify(y, leaf, local, path);
+        at = leaf;
+        if (local > 0) {
+            fresh.insert(fresh.end(), make_move_iterator(t->lines.begin() + local),
+                make_move_iterator(t->lines.end()));
+            t->lines.resize(local);
+            rehash(t);
+            recount(path);
+            at = leaf + 1;
+        }
+    }
+
+    NodePtr middle;
+    for (size_t i = 0; i < fresh.size(); i += LEAF_FILL) {
+        size_t end = min(fresh.size(), i + LEAF_FILL);
+        vector<Line> chunk(make_move_iterator(fresh.begin() + i), make_move_iterator(fresh.begin() + end));
+        middle = merge(move(middle), newLeaf(move(chunk)));
+    }
+
+    NodePtr before, after;
+    split(move(root), at, before, after);
+    root = merge(merge(move(before), move(middle)), move(after));
+    restale(y + count);
+    lexed = min(lexed, y);
+}
+
+void TextBuffer::eraseLine(size_t y)
+{
+    size_t leaf, local;
+    vector<Node*> path;
+    Node* t = modify(y, leaf, local, path);
+    generation++;
+    t->lines.erase(t->lines.begin() + local);
+    rehash(t);
+    recount(path);
+
+    if (t->lines.empty()) {
+        rebalanceLeaf(leaf);
+    }
+    restale(y); // The line after it follows another line now
+    if (listener) {
+        listener->lineErased(y);
+    }
+}
+
+void TextBuffer::splitLine(size_t y, size_t x)
+{
+    string rest = line(y).substr(x);
+    erase(y, x, string::npos);
+    insertLine(y + 1, rest);
+}
+
+void TextBuffer::joinLines(size_t y)
+{
+    string next = line(y + 1);
+    eraseLine(y + 1);
+    Line& l = edit(y);
+    size_t x = l.text->length();
+    *l.text += next;
+    edited(y, l);
+    if (listener) {
+        listener->inserted(y, x, next.data(), next.length());
+    }
+}
+
+void TextBuffer::setGrams(const unordered_map<const void*, shared_ptr<const Trigrams>>& grams)
+{
+    auto f = [&](Node* t) {
+        auto it = grams.find(t);
+        if (it != grams.end())
+            atomic_store(&t->grams, it->second);
+    };
+    forEachNode(root.get(), f);
+}
+
+void TextBuffer::clearGrams()
+{
+    auto f = [](Node* t) {
+        atomic_store(&t->grams, shared_ptr<const Trigrams>());
+    };
+    forEachNode(root.get(), f);
+}
+
+size_t TextBuffer::memory() const
+{
+    // A mapped file's pages stay in memory once they have been read
+    size_t bytes = mapping ? mapping->size() : 0;
+    bytes += arena ? arena->bytes : 0;
+    auto f = [&](Node* t) {
+        bytes += sizeof(Node) + t->lines.capacity() * sizeof(Line);
+        for (const Line& l : t->lines) {
+            if (l.text)
+                bytes += sizeof(string) + l.text->capacity();
+        }
+    };
+    forEachNode(root.get(), f);
+    return bytes;
+}
+
+void TextBuffer::lexTo(size_t last, int id, const function<uint8_t(LineView, uint8_t)>& lex)
+{
+    // Another lexer's states mean nothing. The states are part of the
+    // lines, so the nodes shared with copies are cloned to change them.
+    if (id != lexer) {
+        auto f = [](Line& l) {
+            l.stale = true;
+        };
+        forEachLine(root, 0, 0, size(), f);
+        lexer = id;
+        lexed = 0;
+    }
+
+    last = min(last, size());
+    if (lexed >= last) {
+        return;
+    }
+
+    // A line that isn't stale was lexed from what the line before it ended
+    // in back then. If that's still the same (synced), its state is too.
+    uint8_t state = stateBefore(lexed);
+    bool synced = false;
+    auto f = [&](Line& l) {
+        if (!synced || l.stale) {
+            uint8_t end = lex(l.view(), state);
+            synced = end == l.state;
+            l.state = end;
+            l.stale = false;
+        }
+        state = l.state;
+    };
+    forEachLine(root, 0, lexed, last, f);
+    lexed = last;
+}
+
+uint8_t TextBuffer::stateBefore(size_t y) const
+{
+    if (y == 0) {
+        return 0;
+    }
+    size_t leaf, local;
+    const Node* t = locate(y - 1, leaf, local);
+    return t->lines[local].state;
+}
+
+void TextBuffer::setLines(NodePtr& t, size_t base, vector<pair<size_t, string>>& changes, size_t& at)
+{
+    // Only the nodes above changed lines are cloned
+    if (!t || at == changes.size() || changes[at].first >= base + t->count) {
+        return;
+    }
+    detach(t);
+    Node* n = t.get();
+    size_t start = base + (n->left ? n->left->count : 0);
+    setLines(n->left, base, changes, at);
+
+    size_t end = start + n->lines.size();
+    if (at < changes.size() && changes[at].first < end) {
+        n->grams.reset();
+        for (; at < changes.size() && changes[at].first < end; at++) {
+            n->lines[changes[at].first - start] = ownLine(move(changes[at].second));
+        }
+        rehash(n);
+    }
+    setLines(n->right, end, changes, at);
+    update(n);
+}
+
+void TextBuffer::unmap(NodePtr& t)
+{
+    if (!t) {
+        return;
+    }
+    detach(t);
+    unmap(t->left);
+    const char* start = mapping->data();
+    for (Line& l : t->lines) {
+        // Only the text moves, it's the same so the rest stays
+        if (!l.text && l.data >= start && l.data <= start + mapping->size()) {
+            if (!arena) {
+                arena = make_shared<Arena>();
+            }
+            l.data = arena->add(l.data, l.length);
+        }
+    }
+    unmap(t->right);
+}
+
+void TextBuffer::restale(size_t y)
+{
+    lexed = min(lexed, y);
+    if (y >= size()) {
+        return;
+    }
+    // Only the flag changes, the search index of the leaf stays
+    auto f = [](Line& l) {
+        l.stale = true;
+    };
+    forEachLine(root, 0, y, y + 1, f);
+}
+
+// xorshift32, good enough for treap priorities
+unsigned int TextBuffer::nextPrio()
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+TextBuffer::NodePtr TextBuffer::newLeaf(vector<Line> lines)
+{
+    NodePtr t = make_shared<Node>();
+    t->lines = move(lines);
+    t->prio = nextPrio();
+    rehash(t.get());
+    update(t.get());
+    return t;
+}
+
+TextBuffer::Line TextBuffer::ownLine(string text)
+{
+    Line l;
+    l.text = make_shared<string>(move(text));
+    l.hash = hashLine(l.text->data(), l.text->length());
+    measure(l);
+    return l;
+}
+
+TextBuffer::Line TextBuffer::storedLine(const char* data, size_t n)
+{
+    if (!arena) {
+        arena = make_shared<Arena>();
+    }
+    Line l;
+    l.data = arena->add(data, n);
+    l.length = n;
+    l.hash = hashLine(data, n);
+    measure(l);
+    return l;
+}
+
+TextBuffer::Line TextBuffer::mappedLine(const char*& at, const char* end)
+{
+    // The last line doesn't need a newline
+    Line l;
+    const char* nl = Utf8::scanLine(at, end, l.ascii);
+    l.data = at;
+    l.length = nl - at;
+    l.hash = hashLine(l.data, l.length);
+    if (l.ascii) {
+        l.width = uint32_t(min(l.length, size_t(UINT32_MAX)));
+    } else {
+        l.width = Utf8::measure(l.data, l.length, l.valid);
+    }
+    at = nl < end ? nl + 1 : end;
+    return l;
+}
+
+void TextBuffer::measure(Line& l)
+{
+    LineView v = l.view();
+    l.ascii = Utf8::isAscii(v.data, v.size);
+    l.valid = true;
+    if (l.ascii) {
+        l.width = uint32_t(min(v.size, size_t(UINT32_MAX)));
+    } else {
+        l.width = Utf8::measure(v.data, v.size, l.valid);
+    }
+}
+
+void TextBuffer::rehash(Node* t)
+{
+    t->own = 0;
+    t->ownPower = 1;
+    for (const Line& l : t->lines) {
+        t->own = join(t->own, l.hash, HASH_BASE);
+        t->ownPower = mulMod(t->ownPower, HASH_BASE);
+    }
+}
+
+// Recalculate the subtree totals of a node from its children
+void TextBuffer::update(Node* t)
+{
+    t->count = t->lines.size();
+    t->leaves = 1;
+    t->hash = t->left ? t->left->hash : 0;
+    t->power = t->left ? t->left->power : 1;
+    t->hash = join(t->hash, t->own, t->ownPower);
+    t->power = mulMod(t->power, t->ownPower);
+    if (t->left) {
+        t->count += t->left->count;
+        t->leaves += t->left->leaves;
+    }
+    if (t->right) {
+        t->count += t->right->count;
+        t->leaves += t->right->leaves;
+        t->hash = join(t->hash, t->right->hash, t->right->power);
+        t->power = mulMod(t->power, t->right->power);
+    }
+}
+
+void TextBuffer::detach(NodePtr& t)
+{
+    if (t.use_count() > 1) {
+        t = make_shared<Node>(*t);
+    }
+}
+
+// Concatenate two treaps, every leaf of a comes before the leaves of b
+TextBuffer::NodePtr TextBuffer::merge(NodePtr a, NodePtr b)
+{
+    if (!a)
+        return b;
+    if (!b)
+        return a;
+
+    if (a->prio > b->prio) {
+        detach(a);
+        a->right = merge(move(a->right), move(b));
+        update(a.get());
+        return a;
+    }
+    detach(b);
+    b->left = merge(move(a), move(b->left));
+    update(b.get());
+    return b;
+}
+
+// Split a treap into the first k leaves (a) and the rest (b)
+void TextBuffer::split(NodePtr t, size_t k, NodePtr& a, NodePtr& b)
+{
+    if (!t) {
+        a.reset();
+        b.reset();
+        return;
+    }
+
+    detach(t);
+    size_t leftLeaves = t->left ? t->left->leaves : 0;
+    if (k <= leftLeaves) {
+        NodePtr l;
+        split(move(t->left), k, a, l);
+        t->left = move(l);
+        update(t.get());
+        b = move(t);
+    } else {
+        NodePtr r;
+        split(move(t->right), k - leftLeaves - 1, r, b);
+        t->right = move(r);
+        update(t.get());
+        a = move(t);
+    }
+}
+
+TextBuffer::Node* TextBuffer::locate(size_t y, size_t& leaf, size_t& local) const
+{
+    Node* t = root.get();
+    leaf = 0;
+
+    while (t) {
+        size_t leftCount = t->left ? t->left->count : 0;
+        size_t leftLeaves = t->left ? t->left->leaves : 0;
+        if (y < leftCount) {
+            t = t->left.get();
+            continue;
+        }
+
+        y -= leftCount;
+        // The end of the buffer belongs to the last leaf
+        if (y < t->lines.size() || (y == t->lines.size() && !t->right)) {
+            leaf += leftLeaves;
+            local = y;
+            return t;
+        }
+
+        y -= t->lines.size();
+        leaf += leftLeaves + 1;
+        t = t->right.get();
+    }
+    return nullptr; // Not supposed to happen. Invalid line
+}
+
+TextBuffer::Node* TextBuffer::modify(size_t y, size_t& leaf, size_t& local, vector<Node*>& path)
+{
+    NodePtr* slot = &root;
+    leaf = 0;
+
+    while (*slot) {
+        detach(*slot);
+        Node* t = slot->get();
+        path.push_back(t);
+
+        size_t leftCount = t->left ? t->left->count : 0;
+        size_t leftLeaves = t->left ? t->left->leaves : 0;
+        if (y < leftCount) {
+            slot = &t->left;
+            continue;
+        }
+
+        y -= leftCount;
+        if (y < t->lines.size() || (y == t->lines.size() && !t->right)) {
+            leaf += leftLeaves;
+            local = y;
+            t->grams.reset(); // Detached above, no one else sees it
+            return t;
+        }
+
+        y -= t->lines.size();
+        leaf += leftLeaves + 1;
+        slot = &t->right;
+    }
+    return nullptr; // Not supposed to happen. Invalid line
+}
+
+void TextBuffer::recount(vector<Node*>& path)
+{
+    for (size_t i = path.size(); i > 0; i--) {
+        update(path[i - 1]);
+    }
+}
+
+void TextBuffer::rebalanceLeaf(size_t leaf)
+{
+    // Cut the leaf out of the treap
+    NodePtr before, rest, t, after;
+    split(move(root), leaf, before, rest);
+    split(move(rest), 1, t, after);
+    detach(t);
+
+    if (t->lines.size() > LEAF_MAX) {
+        // Move the upper half of the lines into a new leaf
+        size_t half = t->lines.size() / 2;
+        vector<Line> upper(make_move_iterator(t->lines.begin() + half),
+            make_move_iterator(t->lines.end()));
+        t->lines.resize(half);
+        rehash(t.get());
+        update(t.get());
+
+        before = merge(move(before), move(t));
+        before = merge(move(before), newLeaf(move(upper)));
+    } else if (!t->lines.empty()) {
+        before = merge(move(before), move(t));
+    }
+
+    root = merge(move(before), move(after));
+}
+
+TextBuffer::Line& TextBuffer::edit(size_t y)
+{
+    lexed = min(lexed, y);
+    size_t leaf, local;
+    vector<Node*> path;
+    Node* t = modify(y, leaf, local, path);
+    Line& l = t->lines[local];
+    if (!l.text) {
+        l = ownLine(line(y));
+    } else if (l.text.use_count() > 1) {
+        // The string is shared with a copy of the buffer
+        l.text = make_shared<string>(*l.text);
+    }
+    return l;
+}
+
+void TextBuffer::edited(size_t y, Line& l)
+{
+    measure(l);
+    l.stale = true;
+    l.hash = hashLine(l.text->data(), l.text->length());
+    generation++;
+
+    // The nodes were detached by edit(), walking down again clones nothing
+    size_t leaf, local;
+    vector<Node*> path;
+    Node* t = modify(y, leaf, local, path);
+    rehash(t);
+    recount(path);
+}
+
+// Eight bytes at a time, with a splitmix64 finalizer to spread the bits out.
+// Every line of a file gets hashed as it's indexed.
+uint64_t TextBuffer::hashLine(const char* data, size_t size)
+{
+    const uint64_t MIX = 0x9e3779b97f4a7c15ull;
+    uint64_t h = 14695981039346656037ull ^ size;
+    uint64_t word;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        memcpy(&word, data + i, 8);
+        h = (h ^ word) * MIX;
+        h ^= h >> 32;
+    }
+    // The last few bytes, from a word ending at the end of the line
+    word = 0;
+    if (size >= 8) {
+        memcpy(&word, data + size - 8, 8);
+    } else {
+        for (; i < size; i++)
+            word = word << 8 | (unsigned char)data[i];
+    }
+    h = (h ^ word) * MIX;
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    h = (h & HASH_PRIME) + (h >> 61);
+    return h >= HASH_PRIME ? h - HASH_PRIME : h;
+}
+
+// a * b modulo HASH_PRIME, from 32 bit halves. 2^64 is 8 modulo the prime.
+uint64_t TextBuffer::mulMod(uint64_t a, uint64_t b)
+{
+    uint64_t aLow = uint32_t(a), aHigh = a >> 32, bLow = uint32_t(b), bHigh = b >> 32;
+    uint64_t low = aLow * bLow, mid = aLow * bHigh + aHigh * bLow, high = aHigh * bHigh;
+    uint64_t r = (low & HASH_PRIME) + (low >> 61) + (high << 3) + (mid >> 29) + (mid << 35 >> 3) + 1;
+    r = (r & HASH_PRIME) + (r >> 61);
+    r = (r & HASH_PRIME) + (r >> 61);
+    return r - 1;
+}
+
+// The hash of a run followed by another one of secondPower = HASH_BASE^lines
+uint64_t TextBuffer::join(uint64_t first, uint64_t second, uint64_t secondPower)
+{
+    uint64_t h = mulMod(first, secondPower) + second;
+    return h >= HASH_PRIME ? h - HASH_PRIME : h;
+}
+
+
+void TextBuffer::indexLeaf()
+{
+    const char* data = mapping->data();
+    size_t end = mapping->size();
+
+    bool synced = savedIndexed == indexed;
+    vector<Line> chunk;
+    chunk.reserve(LEAF_FILL);
+    const char* at = data + indexed;
+    while (chunk.size() < LEAF_FILL && at < data + end) {
+        chunk.push_back(mappedLine(at, data + end));
+    }
+    indexed = at - data;
+    indexedLines += chunk.size();
+    appendIndexed(move(chunk), synced);
+    if (synced) {
+        savedIndexed = indexed;
+    }
+}
+
+void TextBuffer::appendIndexed(vector<Line> lines, bool synced)
+{
+    NodePtr t = newLeaf(move(lines));
+    if (synced) {
+        savedHash = join(savedHash, t->hash, t->power);
+        savedLines += t->count;
+    }
+    root = merge(move(root), move(t));
+}
+
+void TextBuffer::indexLeaves(size_t n)
+{
+    const size_t SLICE = 64; // Leaves per task
+    const size_t PARALLEL = 4 * SLICE; // Fewer leaves go one by one
+
+    // The offset after the last leaf is needed too, so the leaves it covers
+    // are full ones ending in a newline
+    vector<size_t> starts;
+    if (offsets && n >= PARALLEL && indexedLines % LEAF_FILL == 0) {
+        size_t first = indexedLines / LEAF_FILL;
+        starts = offsets->offsets(first, n < SIZE_MAX - first ? first + n + 1 : SIZE_MAX);
+    }
+
+    if (starts.size() > PARALLEL) {
+        struct Job {
+            const char* data;
+            vector<size_t> starts;
+            vector<vector<Line>> leaves;
+            atomic<size_t> next{ 0 }, done{ 0 };
+        };
+        shared_ptr<Job> job = make_shared<Job>();
+        job->data = mapping->data();
+        job->starts = move(starts);
+        job->leaves.resize(job->starts.size() - 1);
+        size_t slices = (job->leaves.size() + SLICE - 1) / SLICE;
+
+        // Workers and this thread take slices until there are none left, so
+        // a busy pool just means this thread does more of them
+        auto work = [job, slices]() {
+            size_t slice;
+            while ((slice = job->next.fetch_add(1)) < slices) {
+                size_t last = min(job->leaves.size(), (slice + 1) * SLICE);
+                for (size_t k = slice * SLICE; k < last; k++) {
+                    vector<Line>& chunk = job->leaves[k];
+                    chunk.reserve(LEAF_FILL);
+                    const char* at = job->data + job->starts[k];
+                    const char* end = job->data + job->starts[k + 1];
+                    while (at < end) {
+                        chunk.push_back(mappedLine(at, end));
+                    }
+                }
+                job->done.fetch_add(1, memory_order_release);
+            }
+        };
+        size_t helpers = min(sharedPool().size(), slices) - 1;
+        for (size_t i = 0; i < helpers; i++) {
+            sharedPool().submit(work);
+        }
+        work();
+        while (job->done.load(memory_order_acquire) < slices) {
+            this_thread::yield();
+        }
+
+        bool synced = savedIndexed == indexed;
+        for (vector<Line>& chunk : job->leaves) {
+            appendIndexed(move(chunk), synced);
+        }
+        indexed = job->starts.back();
+        if (synced) {
+            savedIndexed = indexed;
+        }
+        indexedLines += job->leaves.size() * LEAF_FILL;
+        n -= job->leaves.size();
+    }
+
+    while (n-- > 0 && !complete()) {
+        indexLeaf();
+    }
+}
@@ -0,0 +1,351 @@
+// buffer.hpp
+#ifndef BUFFER_H
+#define BUFFER_H
+
+// Text buffer for the textSoup text editor
+#include <functional>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+class LineIndex; // lineindex.hpp
+class MappedFile; // files.hpp
+struct Trigrams; // trigram.hpp
+
+// A read-only view of a line's text and what is known about it as UTF-8
+// (see utf8.hpp)
+struct LineView {
+    const char* data;
+    size_t size;
+    uint32_t width; // Columns on the screen
+    bool ascii; // Every byte is ASCII, a byte is a column
+    bool valid; // It's valid UTF-8
+
+    string str() const { return string(data, size); }
+};
+
+// Gets told about every edit made to a TextBuffer (see
+// TextBuffer::listen()).
+class EditListener {
+public:
+    virtual ~EditListener() {}
+    virtual void inserted(size_t y, size_t x, const char* text, size_t n) = 0;
+    virtual void erased(size_t y, size_t x, size_t n) = 0;
+    virtual void lineSet(size_t y, const string& text) = 0;
+    virtual void linesInserted(size_t y, const vector<string>& texts) = 0;
+    virtual void lineErased(size_t y) = 0;
+};
+
+// The lines are kept in leaves of up to LEAF_MAX lines which are the nodes of
+// an implicit treap ordered by position. Every node knows how many lines and
+// leaves are in its subtree so finding, inserting and erasing a line all cost
+// O(log n) no matter how many lines there are.
+//
+// Copying a buffer is O(1): the copies share their nodes and line strings
+// and each copy clones the nodes on the path to an edit before changing them
+// (copy-on-write). A copy can be read on another thread while the original
+// keeps being edited, which is how background saves get their snapshot.
+//
+// A buffer loaded from a memory mapped file doesn't copy anything at first:
+// the lines point into the mapping and get their own string only once they
+// are edited. Other lines that come in (a file that can't be mapped, new
+// lines, pastes) are copied into an arena of big chunks the same way, with
+// a newline after each, so a line that isn't edited costs its bytes and a
+// Line. A line's text is only its own bytes, the cursor can be one past
+// its end. Lines are also split out of the mapping lazily, indexTo() and
+// indexAll() scan forward only as far as they are needed. Meanwhile a
+// LineIndex counts the lines of the whole file in the background; once it
+// knows where the leaves start, a long jump forward splits them on the
+// thread pool instead of walking the lines one by one.
+class TextBuffer {
+public:
+    TextBuffer();
+
+    // Replace the contents of the buffer with the given lines
+    void assign(vector<string> lines);
+    // Replace the contents of the buffer with a mapped file's lines
+    void assign(shared_ptr<MappedFile> file);
+    // Copy the lines out of the mapped file into the arena and let go of
+    // it, before another program writes the file in place. Copies of the
+    // buffer keep theirs.
+    void unmap();
+    const MappedFile* mapped() const { return mapping.get(); } // Null if none
+
+    size_t size() const; // Amount of lines indexed so far
+    bool complete() const; // Has the whole file been indexed?
+    size_t lineCount() const; // Lines in the buffer as far as they're counted
+    bool counted() const; // Is lineCount() final?
+    void indexTo(size_t y); // Index the lines before y if the file has them
+    void indexAll(); // Index the whole file
+    LineView tail() const; // The bytes of the file not indexed yet
+    size_t memory() const; // Bytes it takes, the mapped file's included
+
+    string line(size_t y) const; // Get a copy of a line
+    size_t length(size_t y) const; // Bytes in line y
+    LineView view(size_t y) const; // The text of a line without copying it
+    bool equals(const vector<string>& lines); // Compare with lines
+
+    // Every edit bumps the generation, and the tree keeps a hash of its lines
+    // in order up to date, so checking for unsaved changes never has to look
+    // at the text
+    uint64_t version() const { return generation; }
+    bool modified() const; // Are there changes since the last save?
+    void markSaved(); // The current contents are what's on disk
+    void markSaved(const TextBuffer& snapshot); // A copy of this buffer was saved
+
+    // Tell l about the edits from now on (null: nobody). Loading a file
+    // with assign() isn't an edit, and copies share the listener.
+    void listen(shared_ptr<EditListener> l) { listener = move(l); }
+
+    // Editing
+    void insertChar(size_t y, size_t x, char c);
+    void insertText(size_t y, size_t x, const string& text);
+    void erase(size_t y, size_t x, size_t n);
+    void setLine(size_t y, const string& text);
+    // Set many lines in one walk over the tree, lines is sorted by y
+    void setLines(vector<pair<size_t, string>> lines);
+    void insertLine(size_t y, const string& text);
+    void insertLines(size_t y, vector<string> texts); // Many lines in one go
+    void eraseLine(size_t y);
+    void splitLine(size_t y, size_t x); // Move [x, end) to a new line below
+    void joinLines(size_t y); // Append line y + 1 to line y
+
+    // Call f(data, size) for the bytes of the whole file in order, with a
+    // newline after every line. Untouched lines that follow each other in the
+    // mapping come out as one run, newlines included.
+    void forEachRun(const function<void(const char*, size_t)>& f) const;
+
+    // Call f(y, view) for every indexed line in [first, last) in order
+    template <typename F>
+    void forEach(size_t first, size_t last, F f) const
+    {
+        if (first < last)
+            forEach(root.get(), 0, first, last, f);
+    }
+
+    // Call f(y, count, id, grams) for every leaf with lines in [first, last)
+    // in order, y being its first line. A leaf's id stays the same until its
+    // lines change. grams is the leaf's search index or null if it has none.
+    template <typename F>
+    void forEachLeaf(size_t first, size_t last, F f) const
+    {
+        if (first < last)
+            forEachLeaf(root.get(), 0, first, last, f);
+    }
+
+    // Give leaves their search index, by id. Edits drop the index of the
+    // leaf they change. Readers on other threads may be looking at it.
+    void setGrams(const unordered_map<const void*, shared_ptr<const Trigrams>>& grams);
+    void clearGrams(); // Drop the whole search index
+
+    // Lexer states for highlighting (highlight.hpp). Every line keeps the
+    // state a lexer was in at its end. Edits mark the lines they change as
+    // stale, and lexing again stops being needed as soon as a line ends in
+    // the same state as before. lex(line, state) gives the state at the end
+    // of a line starting in state, lexer tells lexers apart.
+    void lexTo(size_t last, int lexer, const function<uint8_t(LineView, uint8_t)>& lex);
+    uint8_t stateBefore(size_t y) const; // At the start of line y (< lexed)
+
+private:
+    static const size_t LEAF_MAX = 256; // Split leaves bigger than this
+    static const size_t LEAF_FILL = 128; // Lines per leaf when loading
+
+    // A line either points into the mapped file or the arena, or owns its
+    // text once it's edited. The width is worked out whenever the text
+    // changes, so drawing never has to.
+    struct Line {
+        const char* data = nullptr;
+        size_t length = 0;
+        shared_ptr<string> text;
+        uint32_t width = 0;
+        bool ascii = true, valid = true;
+        uint8_t state = 0; // Lexer state at the end of the line
+        bool stale = true; // Changed since state was worked out
+        uint64_t hash = 0; // Of the text (see hashLine())
+
+        LineView view() const
+        {
+            if (text)
+                return LineView{ text->data(), text->length(), width, ascii, valid };
+            return LineView{ data, length, width, ascii, valid };
+        }
+    };
+
+    struct Node;
+    typedef shared_ptr<Node> NodePtr;
+    struct Node {
+        vector<Line> lines; // The lines in this leaf
+        size_t count = 0; // Lines in the subtree
+        size_t leaves = 1; // Leaves in the subtree
+        unsigned int prio = 0; // Heap priority of the treap
+        uint64_t own = 0, ownPower = 1; // Hash of the lines of this leaf
+        uint64_t hash = 0, power = 1; // Hash of the lines of the subtree
+        NodePtr left, right;
+        shared_ptr<const Trigrams> grams; // Index of the lines (atomic access)
+    };
+
+    NodePtr root;
+    unsigned int seed = 2463534242u; // State of the priority generator
+
+    struct Arena;
+    shared_ptr<Arena> arena; // Lines that aren't in the file nor edited, shared by copies
+    shared_ptr<MappedFile> mapping; // The file the lines point into
+    size_t indexed = 0; // Bytes of the mapping split into lines so far
+    size_t indexedLines = 0; // Lines of the mapping split out so far
+    shared_ptr<LineIndex> offsets; // Counts the lines of the mapping
+
+    shared_ptr<EditListener> listener;
+
+    int lexer = -1; // Whose states the lines have
+    size_t lexed = 0; // Lines before this have up to date states
+
+    // What was saved last: the hash and size of the indexed lines then, which
+    // follows the indexing as long as savedIndexed is in step with indexed
+    uint64_t generation = 0; // Bumped by every edit
+    uint64_t savedGeneration = 0, savedHash = 0;
+    size_t savedLines = 0, savedIndexed = 0;
+
+    unsigned int nextPrio();
+    NodePtr newLeaf(vector<Line> lines);
+    static Line ownLine(string text);
+    Line storedLine(const char* data, size_t n); // Copied into the arena
+    static Line mappedLine(const char*& at, const char* end); // Moves at past it
+    static void measure(Line& l); // Work out the width and kind of text
+
+    static void rehash(Node* t); // Work out the hash of a leaf's lines
+    static void update(Node* t);
+    static void detach(NodePtr& t); // Clone a node shared with a copy
+    static NodePtr merge(NodePtr a, NodePtr b);
+    static void split(NodePtr t, size_t k, NodePtr& a, NodePtr& b);
+
+    // Find the leaf holding line y, its leaf index and the line's local index.
+    // A y equal to size() gives the end of the last leaf.
+    Node* locate(size_t y, size_t& leaf, size_t& local) const;
+    // Same as locate() but detaches the nodes on the way down so they can be
+    // changed, and stores them in path so their counts can be fixed later
+    Node* modify(size_t y, size_t& leaf, size_t& local, vector<Node*>& path);
+    // Set the lines of changes from at on that are in t, base being its
+    // first line
+    void setLines(NodePtr& t, size_t base, vector<pair<size_t, string>>& changes, size_t& at);
+    // Move the mapped lines in t into the arena
+    void unmap(NodePtr& t);
+    // Mark line y as stale and lex again from it
+    void restale(size_t y);
+    // Fix the counts of the nodes on a path after its leaf has changed size
+    static void recount(vector<Node*>& path);
+    // Split an overgrown leaf in two, or drop an empty one
+    void rebalanceLeaf(size_t leaf);
+    // Get a line with its own text for editing, copying it out of the
+    // mapping or the arena. edited() fixes up its width and the hashes.
+    Line& edit(size_t y);
+    void edited(size_t y, Line& l);
+    // Lines hash to numbers below HASH_PRIME, and a run of lines to the
+    // polynomial of their hashes in HASH_BASE, so runs join up in order
+    static uint64_t hashLine(const char* data, size_t size);
+    static uint64_t mulMod(uint64_t a, uint64_t b);
+    static uint64_t join(uint64_t first, uint64_t second, uint64_t secondPower);
+    // Append a leaf split out of the mapping. The saved contents have its
+    // lines too when synced.
+    void appendIndexed(vector<Line> lines, bool synced);
+    // Split the next leaf worth of lines out of the mapping
+    void indexLeaf();
+    // Split the next n leaves, on the pool as far as the offsets reach
+    void indexLeaves(size_t n);
+
+    template <typename F>
+    static void forEachLine(const Node* t, F& f)
+    {
+        if (!t)
+            return;
+        forEachLine(t->left.get(), f);
+        for (const Line& l : t->lines) {
+            f(l);
+        }
+        forEachLine(t->right.get(), f);
+    }
+
+    // Call f(line) for the lines in [first, last) to change them, cloning
+    // the nodes on the way that are shared with a copy
+    template <typename F>
+    static void forEachLine(NodePtr& t, size_t base, size_t first, size_t last, F& f)
+    {
+        if (!t || base >= last)
+            return;
+        detach(t);
+        size_t leftCount = t->left ? t->left->count : 0;
+        if (first < base + leftCount)
+            forEachLine(t->left, base, first, last, f);
+
+        size_t start = base + leftCount;
+        for (size_t i = 0; i < t->lines.size(); i++) {
+            if (start + i >= last)
+                return;
+            if (start + i >= first)
+                f(t->lines[i]);
+        }
+
+        size_t rightBase = start + t->lines.size();
+        if (last > rightBase)
+            forEachLine(t->right, rightBase, first, last, f);
+    }
+
+    template <typename F>
+    static void forEachNode(Node* t, F& f)
+    {
+        if (!t)
+            return;
+        forEachNode(t->left.get(), f);
+        f(t);
+        forEachNode(t->right.get(), f);
+    }
+
+    template <typename F>
+    static void forEachLeaf(const Node* t, size_t base, size_t first, size_t last, F& f)
+    {
+        if (!t || base >= last)
+            return;
+        size_t leftCount = t->left ? t->left->count : 0;
+        if (first < base + leftCount)
+            forEachLeaf(t->left.get(), base, first, last, f);
+
+        size_t start = base + leftCount;
+        if (start >= last)
+            return;
+        if (start + t->lines.size() > first && !t->lines.empty())
+            f(start, t->lines.size(), static_cast<const void*>(t), atomic_load(&t->grams));
+
+        size_t rightBase = start + t->lines.size();
+        if (last > rightBase)
+            forEachLeaf(t->right.get(), rightBase, first, last, f);
+    }
+
+    template <typename F>
+    static void forEach(const Node* t, size_t base, size_t first, size_t last, F& f)
+    {
+        if (!t || base >= last)
+            return;
+        size_t leftCount = t->left ? t->left->count : 0;
+        if (first < base + leftCount)
+            forEach(t->left.get(), base, first, last, f);
+
+        size_t start = base + leftCount;
+        for (size_t i = 0; i < t->lines.size(); i++) {
+            size_t y = start + i;
+            if (y >= last)
+                return;
+            if (y >= first)
+                f(y, t->lines[i].view());
+        }
+
+        size_t rightBase = start + t->lines.size();
+        if (last > rightBase)
+            forEach(t->right.get(), rightBase, first, last, f);
+    }
+};
+
+#endif // BUFFER_H
@@ -0,0 +1,108 @@
+/*
+*    TextSoup, Yet another text editor
+*    Copyright (C) 2017  Jyry Hjelt
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*/
+// buffers.cpp
+
+// Include the libraries
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "buffers.hpp"
+#include "files.hpp"
+
+using namespace std;
+
+BufferManager::BufferManager()
+{
+    const char* megabytes = getenv("TEXTSOUP_BUFFER_MB");
+    size_t mb = megabytes ? strtoull(megabytes, nullptr, 10) : 0;
+    budget = (mb ? mb : 512) << 20;
+}
+
+size_t BufferManager::find(const string& name) const
+{
+    for (size_t i = 0; i < buffers.size(); i++) {
+        if (buffers[i].name == name)
+            return i;
+    }
+    return string::npos;
+}
+
+size_t BufferManager::add(const string& name)
+{
+    OpenBuffer b;
+    b.name = name;
+    buffers.push_back(move(b));
+    return buffers.size() - 1;
+}
+
+void BufferManager::use(size_t i)
+{
+    current = i;
+    buffers[i].used = ++clock;
+}
+
+size_t BufferManager::modified() const
+{
+    for (size_t i = 0; i < buffers.size(); i++) {
+        if (i != current && buffers[i].loaded && buffers[i].text.modified())
+            return i;
+    }
+    return string::npos;
+}
+
+void BufferManager::clear()
+{
+    buffers.clear();
+    current = 0;
+}
+
+vector<string> BufferManager::trim(size_t currentBytes)
+{
+    size_t total = currentBytes;
+    for (size_t i = 0; i < buffers.size(); i++) {
+        if (i != current && buffers[i].loaded)
+            total += buffers[i].bytes;
+    }
+
+    vector<string> dropped;
+    while (total > budget) {
+        // The least recently used one that can be read back as it is
+        size_t oldest = string::npos;
+        for (size_t i = 0; i < buffers.size(); i++) {
+            OpenBuffer& b = buffers[i];
+            if (i == current || !b.loaded || b.text.modified() || b.follower || !fileExists(b.name))
+                continue;
+            if (oldest == string::npos || b.used < buffers[oldest].used)
+                oldest = i;
+        }
+        if (oldest == string::npos) {
+            break; // Everything left has changes or is on the screen
+        }
+
+        OpenBuffer& b = buffers[oldest];
+        total -= b.bytes;
+        if (b.journal) {
+            b.journal->remove(); // The file has it all
+            b.journal.reset();
+        }
+        b.watch.reset();
+        b.text = TextBuffer();
+        b.loaded = false;
+        b.bytes = 0;
+        dropped.push_back(b.name);
+    }
+    return dropped;
+}
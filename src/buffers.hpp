@@ -0,0 +1,59 @@
+// buffers.hpp
+#ifndef BUFFERS_H
+#define BUFFERS_H
+
+// The files open in the editor
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "buffer.hpp"
+#include "follow.hpp"
+#include "journal.hpp"
+#include "watch.hpp"
+
+using namespace std;
+
+// A file that is open and where the cursor was in it. The one on the screen
+// is in the editor's globals, its text here is empty until it's put away.
+struct OpenBuffer {
+    string name;
+    TextBuffer text;
+    bool loaded = false; // false: the text has to be read from the file
+    unsigned int cursX = 0, cursY = 0, lineArea = 0;
+    uint64_t used = 0; // When it was last on the screen
+    size_t bytes = 0; // Memory its text took when it was put away
+    shared_ptr<Follower> follower; // Appends to the text, it's never dropped
+    bool autoScroll = false;
+    shared_ptr<Journal> journal; // Its edits since the last save
+    shared_ptr<FileWatch> watch; // Notices the file changing on disk
+};
+
+// Keeps the open files within a memory budget. When they take more, the
+// least recently used ones without unsaved changes drop their text and
+// load it from the file again when they're switched to. The budget is
+// TEXTSOUP_BUFFER_MB megabytes (512 by default).
+class BufferManager {
+public:
+    BufferManager();
+
+    vector<OpenBuffer> buffers; // In the order they were opened
+    size_t current = 0; // The one on the screen
+    size_t budget; // Bytes
+
+    size_t find(const string& name) const; // npos if it isn't open
+    size_t add(const string& name); // Open a file, it's loaded when shown
+    void use(size_t i); // i is on the screen now
+    size_t modified() const; // Another buffer with unsaved changes, or npos
+    void clear();
+
+    // Drop the text of buffers until all of them with the current one
+    // taking currentBytes fit, and give the names of the dropped ones
+    vector<string> trim(size_t currentBytes);
+
+private:
+    uint64_t clock = 0;
+};
+
+#endif // BUFFERS_H
@@ -0,0 +1,214 @@
+/*
+*    TextSoup, Yet another text editor
+*    Copyright (C) 2017  Jyry Hjelt
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*/
+// diff.cpp
+
+// Include the libraries
+#include <algorithm>
+#include <string.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "diff.hpp"
+
+using namespace std;
+
+namespace {
+
+const size_t STEP = 4096; // Lines compared at a time at the start and end
+const int MAX_EDITS = 1024; // Lines added and removed before giving up
+const size_t MAX_WORK = size_t(1) << 25; // Lines compared before giving up
+
+bool same(const LineView& x, const LineView& y)
+{
+    return x.size == y.size && memcmp(x.data, y.data, x.size) == 0;
+}
+
+void gather(const TextBuffer& t, size_t first, size_t last, vector<LineView>& out)
+{
+    out.clear();
+    t.forEach(first, last, [&](size_t, LineView line) { out.push_back(line); });
+}
+
+// Lines a and b start with
+size_t commonStart(const TextBuffer& a, const TextBuffer& b)
+{
+    size_t n = min(a.size(), b.size());
+    vector<LineView> x, y;
+    for (size_t first = 0; first < n; first += STEP) {
+        size_t last = min(n, first + STEP);
+        gather(a, first, last, x);
+        gather(b, first, last, y);
+        for (size_t i = 0; i < x.size(); i++) {
+            if (!same(x[i], y[i]))
+                return first + i;
+        }
+    }
+    return n;
+}
+
+// Lines a and b end with, at most n of them
+size_t commonEnd(const TextBuffer& a, const TextBuffer& b, size_t n)
+{
+    vector<LineView> x, y;
+    for (size_t done = 0; done < n; done += STEP) {
+        size_t count = min(n - done, STEP);
+        gather(a, a.size() - done - count, a.size() - done, x);
+        gather(b, b.size() - done - count, b.size() - done, y);
+        for (size_t i = count; i-- > 0;) {
+            if (!same(x[i], y[i]))
+                return done + count - 1 - i;
+        }
+    }
+    return n;
+}
+
+// Myers' O(ND) diff of the lines in between, as hunks starting from 0
+bool myers(const vector<LineView>& a, const vector<LineView>& b, vector<Hunk>& hunks)
+{
+    int n = int(a.size()), m = int(b.size());
+    int most = min(n + m, MAX_EDITS);
+    vector<int> v(2 * most + 3, 0);
+    const int off = most + 1;
+    vector<vector<int>> trace; // v[-d..d] after every round d
+    size_t work = 0;
+
+    // Find how many edits it takes, furthest reaching path on every diagonal
+    int edits = -1;
+    for (int d = 0; d <= most && edits < 0; d++) {
+        for (int k = -d; k <= d; k += 2) {
+            int x = (k == -d || (k != d && v[off + k - 1] < v[off + k + 1])) ? v[off + k + 1] : v[off + k - 1] + 1;
+            int y = x - k;
+            while (x < n && y < m && same(a[x], b[y])) {
+                x++;
+                y++;
+                work++;
+            }
+            work++;
+            v[off + k] = x;
+            if (x >= n && y >= m) {
+                edits = d;
+                break;
+            }
+        }
+        trace.emplace_back(v.begin() + off - d, v.begin() + off + d + 1);
+        if (work > MAX_WORK) {
+            return false;
+        }
+    }
+    if (edits < 0) {
+        return false;
+    }
+
+    // Walk back through the rounds to find every line added or removed
+    vector<pair<int, int>> moves; // (x, y) before the edit, y < 0 means removing a[x]
+    int x = n, y = m;
+    for (int d = edits; d > 0; d--) {
+        const vector<int>& last = trace[d - 1]; // Its index 0 is diagonal -(d - 1)
+        int k = x - y;
+        bool down = k == -d || (k != d && last[k - 1 + d - 1] < last[k + 1 + d - 1]);
+        int prevK = down ? k + 1 : k - 1;
+        int prevX = last[prevK + d - 1];
+        int prevY = prevX - prevK;
+        moves.push_back(down ? make_pair(prevX, prevY) : make_pair(prevX, -1 - prevY));
+        x = prevX;
+        y = prevY;
+    }
+    reverse(moves.begin(), moves.end());
+
+    // Edits next to each other make one hunk
+    for (const pair<int, int>& e : moves) {
+        bool removing = e.second < 0;
+        size_t at = e.first, to = removing ? -1 - e.second : e.second;
+        if (hunks.empty() || hunks.back().oldStart + hunks.back().oldCount != at
+            || hunks.back().newStart + hunks.back().newCount != to) {
+            hunks.push_back(Hunk{ at, 0, to, 0 });
+        }
+        if (removing)
+            hunks.back().oldCount++;
+        else
+            hunks.back().newCount++;
+    }
+    return true;
+}
+} // namespace
+
+bool diffLines(const TextBuffer& a, const TextBuffer& b, vector<Hunk>& hunks)
+{
+    hunks.clear();
+    size_t start = commonStart(a, b);
+    size_t end = commonEnd(a, b, min(a.size(), b.size()) - start);
+    size_t oldCount = a.size() - start - end, newCount = b.size() - start - end;
+    if (oldCount == 0 && newCount == 0) {
+        return true;
+    }
+
+    // The middle is only read if it's small enough to be worth diffing
+    bool diffed = false;
+    size_t shorter = min(oldCount, newCount), longer = max(oldCount, newCount);
+    if (shorter <= MAX_WORK / 2 && longer - shorter <= size_t(MAX_EDITS)) {
+        vector<LineView> x, y;
+        gather(a, start, start + oldCount, x);
+        gather(b, start, start + newCount, y);
+        diffed = myers(x, y, hunks);
+    }
+    if (!diffed) {
+        hunks.assign(1, Hunk{ 0, oldCount, 0, newCount });
+    }
+    for (Hunk& h : hunks) {
+        h.oldStart += start;
+        h.newStart += start;
+    }
+    return diffed;
+}
+
+void patchLines(TextBuffer& a, const TextBuffer& b, const vector<Hunk>& hunks)
+{
+    // From the end so the hunks before keep their line numbers
+    for (size_t i = hunks.size(); i-- > 0;) {
+        const Hunk& h = hunks[i];
+        size_t same = min(h.oldCount, h.newCount);
+        vector<pair<size_t, string>> changed;
+        for (size_t j = 0; j < same; j++) {
+            changed.emplace_back(h.oldStart + j, b.line(h.newStart + j));
+        }
+        for (size_t j = same; j < h.oldCount; j++) {
+            a.eraseLine(h.oldStart + same);
+        }
+        vector<string> added;
+        for (size_t j = same; j < h.newCount; j++) {
+            added.push_back(b.line(h.newStart + j));
+        }
+        if (!added.empty()) {
+            a.insertLines(h.oldStart + same, move(added));
+        }
+        a.setLines(move(changed));
+    }
+}
+
+size_t movedLine(size_t y, const vector<Hunk>& hunks)
+{
+    size_t moved = y;
+    for (const Hunk& h : hunks) {
+        if (y < h.oldStart) {
+            break;
+        }
+        if (y < h.oldStart + h.oldCount) {
+            return h.newStart + min(y - h.oldStart, h.newCount > 0 ? h.newCount - 1 : 0);
+        }
+        moved = y - h.oldStart - h.oldCount + h.newStart + h.newCount;
+    }
+    return moved;
+}
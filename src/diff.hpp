@@ -0,0 +1,35 @@
+// diff.hpp
+#ifndef DIFF_H
+#define DIFF_H
+
+// Finding the lines that differ between two buffers, for reloading a file
+// that changed on disk without starting over
+#include <stddef.h>
+#include <vector>
+
+#include "buffer.hpp"
+
+using namespace std;
+
+// Lines [oldStart, oldStart + oldCount) of the old buffer are lines
+// [newStart, newStart + newCount) in the new one
+struct Hunk {
+    size_t oldStart, oldCount;
+    size_t newStart, newCount;
+};
+
+// Put the hunks that turn a into b into hunks, in order. The lines both
+// start and end with are skipped first by comparing them, then the rest is
+// diffed with Myers' algorithm. That gives up when it gets expensive (the
+// buffers are too different): false, and hunks has the one hunk between the
+// common start and end.
+bool diffLines(const TextBuffer& a, const TextBuffer& b, vector<Hunk>& hunks);
+
+// Make a like b by changing the lines of the hunks only
+void patchLines(TextBuffer& a, const TextBuffer& b, const vector<Hunk>& hunks);
+
+// Where line y of the old buffer is in the new one. A line that was changed
+// goes to the start of what replaced it.
+size_t movedLine(size_t y, const vector<Hunk>& hunks);
+
+#endif // DIFF_H
@@ -0,0 +1,1520 @@
+/*
+*    TextSoup, Yet another text editor
+*    Copyright (C) 2017  Jyry Hjelt
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*/
+// editor.cpp
+
+// Include the libraries
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <iostream>
+#include <memory>
+#include <ncurses.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "buffer.hpp"
+#include "buffers.hpp"
+#include "diff.hpp"
+#include "editor.h"
+#include "files.hpp"
+#include "follow.hpp"
+#include "highlight.hpp"
+#include "journal.hpp"
+#include "logging.hpp"
+#include "render.hpp"
+#include "save.hpp"
+#include "stats.hpp"
+#include "terminal.hpp"
+#include "trigram.hpp"
+#include "utf8.hpp"
+#include "watch.hpp"
+
+using namespace std;
+
+// Important variables
+unsigned int MAX_X = 0, MAX_Y = 0; // Window's current dimensions
+unsigned int CURS_X = 0, CURS_Y = 0; // Cursor's position
+int key = 0; // The value of the key presses is stored into 'int key'
+
+string fileName = ""; // Name of the file
+TextBuffer LineBuffer; // the buffer that stores the lines
+BufferManager buffers; // Every open file, LineBuffer is the current one's
+bool running = true; // Boolean to determine if the program is running
+unsigned int lineArea = 0; // Used to declare the area to draw the lines in
+
+Terminal* terminal = nullptr; // Where the keys come from and the rows go
+Renderer screen; // Draws the changed rows of the screen
+BackgroundSave saver; // Saves files without blocking the keyboard
+SearchEngine searcher; // Remembers the last search to narrow it down
+bool exitAfterSave = false; // Quit once the running save is done
+TrigramIndex indexer; // Lets searches skip most of a big buffer (^T)
+bool announceIndex = false; // Show the stats when the build is done
+bool showTimings = false; // Frame and key latencies in the status bar (^P)
+shared_ptr<Follower> follower; // Lines coming in to the buffer (soup - and --follow)
+bool autoScroll = false; // Keep the last line on the screen while following (^A)
+shared_ptr<Journal> journal; // The edits since the last save, for crash recovery
+chrono::steady_clock::time_point journalWritten; // When the journal was last flushed
+shared_ptr<FileWatch> watch; // Notices other programs changing the file
+bool confirmOverwrite = false; // The next save may write over the changes on disk
+bool confirmReload = false; // The next ^L may drop the unsaved changes
+
+string messageBar = "";
+MsgBarStatus MessageBarStatus = CLEAR;
+vector<SearchHit> searchResults;
+Replacement lastReplace; // The last replace-all, it can be undone until the next edit (^Z)
+
+// Start over with the file called name, it's loaded if it exists
+void loadEditor(const string& name)
+{
+    // Let a save that is still running finish
+    pollSave(true);
+    searcher.reset();
+    indexer.reset(LineBuffer);
+    indexer.enabled = false;
+
+    fileName = name;
+    LineBuffer = TextBuffer(); // One empty line
+    searchResults.clear();
+    lastReplace = Replacement();
+    CURS_X = CURS_Y = 0;
+    lineArea = 0;
+    messageBar = "";
+    MessageBarStatus = CLEAR;
+    exitAfterSave = false;
+    follower.reset();
+    autoScroll = false;
+    running = true;
+    key = 0;
+
+    buffers.clear();
+    buffers.use(buffers.add(fileName));
+    buffers.buffers[0].loaded = true;
+
+    if (fileExists(fileName)) {
+        loadFile(fileName, LineBuffer);
+    }
+    watch.reset();
+    if (!fileName.empty()) {
+        watch = make_shared<FileWatch>(fileName);
+    }
+    confirmOverwrite = confirmReload = false;
+    messageBar = startJournal();
+}
+
+// Open another file next to the ones that are open, it's read when it's
+// switched to
+void addBuffer(const string& name)
+{
+    if (buffers.find(name) == string::npos) {
+        buffers.add(name);
+    }
+}
+
+// Show an open file or open a new one
+void openBuffer(const string& name)
+{
+    buffers.buffers[buffers.current].name = fileName; // Saved under another name
+    size_t i = buffers.find(name);
+    if (i == string::npos) {
+        i = buffers.add(name);
+    }
+    switchBuffer(i);
+}
+
+// Put the current file away and show open file i instead
+void switchBuffer(size_t i)
+{
+    if (i == buffers.current) {
+        return;
+    }
+
+    OpenBuffer& old = buffers.buffers[buffers.current];
+    old.name = fileName;
+    old.text = move(LineBuffer);
+    old.loaded = true;
+    old.bytes = old.text.memory();
+    old.cursX = CURS_X;
+    old.cursY = CURS_Y;
+    old.lineArea = lineArea;
+    old.follower = move(follower);
+    old.autoScroll = autoScroll;
+    if (journal) {
+        journal->flush();
+    }
+    old.journal = move(journal);
+    old.watch = move(watch);
+    confirmOverwrite = confirmReload = false;
+
+    // What the search and the index know is about the old buffer
+    searcher.reset();
+    indexer.reset(old.text);
+    indexer.enabled = false;
+    searchResults.clear();
+    lastReplace = Replacement();
+
+    OpenBuffer& b = buffers.buffers[i];
+    fileName = b.name;
+    string recovered;
+    if (b.loaded) {
+        LineBuffer = move(b.text);
+        b.text = TextBuffer();
+        journal = move(b.journal);
+        watch = move(b.watch);
+    } else {
+        LineBuffer = TextBuffer();
+        if (fileExists(fileName)) {
+            loadFile(fileName, LineBuffer);
+        }
+        recovered = startJournal();
+        b.loaded = true;
+    }
+    buffers.use(i);
+    follower = move(b.follower);
+    autoScroll = b.autoScroll;
+
+    // The file may have gotten shorter if it was read again
+    LineBuffer.indexTo(b.cursY + 1);
+    CURS_Y = min(size_t(b.cursY), LineBuffer.size() - 1);
+    CURS_X = min(size_t(b.cursX), LineBuffer.length(CURS_Y));
+    lineArea = min(b.lineArea, CURS_Y);
+
+    for (const string& name : buffers.trim(LineBuffer.memory())) {
+        Logging::logEntry("Dropped " + name + " from memory, it's read again when needed",
+            Logging::INFO);
+    }
+    messageBar = "[" + to_string(i + 1) + "/" + to_string(buffers.buffers.size()) + "] "
+        + (fileName.empty() ? "(no name)" : fileName);
+    if (!recovered.empty()) {
+        messageBar += ": " + recovered;
+    }
+
+    // It may have changed while it wasn't on the screen
+    if (!watch && !fileName.empty()) {
+        watch = make_shared<FileWatch>(fileName);
+    } else if (watch && !follower && watch->check()) {
+        keepText();
+        messageBar += " changed on disk, ^L reloads it";
+    }
+}
+
+// Keep a journal of the edits to fileName from now on. If one was left
+// behind by an editor that never got to quit, its edits are made again
+// first. Gives what happened with that, if anything.
+string startJournal()
+{
+    journal.reset();
+    if (fileName.empty()) {
+        return "";
+    }
+
+    journal = make_shared<Journal>(fileName);
+    string path = Journal::pathFor(fileName);
+    string note;
+    if (fileExists(path)) {
+        string why;
+        long edits = journal->recover(LineBuffer, why);
+        if (edits >= 0) {
+            note = "Recovered " + to_string(edits) + " unsaved edits from " + path;
+        } else {
+            note = why;
+        }
+        Logging::logEntry(note, edits >= 0 ? Logging::INFO : Logging::WARN);
+    }
+    LineBuffer.listen(journal);
+    return note;
+}
+
+// Run the editor until the user quits
+void runEditor(Terminal& term)
+{
+    terminal = &term;
+    screen.invalidate();
+    Stats::Timer::Clock::time_point began = Stats::Timer::Clock::now();
+    bool drawn = false;
+
+    // Main loop
+    while (running) {
+        // Check on a save running in the background
+        pollSave(false);
+        if (!running) {
+            break;
+        }
+
+        // Pick up a finished index build, or index edits after a quiet spell
+        pollIndex(key == ERR);
+
+        // Append what came in to a file or a pipe that is followed
+        pollFollow();
+
+        // Put the latest edits in the journal
+        pollJournal();
+
+        // Tell if another program changed the file
+        pollWatch();
+
+        // Update
+        updateScr();
+        if (!drawn) {
+            drawn = true;
+            Stats::startupPhase("first frame", began); // For --trace-startup
+        }
+
+        // If there is MessageBarStatus to handle (eg. save, exit)
+        if (MessageBarStatus != CLEAR) {
+            handleMsgBar(MessageBarStatus);
+        } else {
+            // If no MessageBarStatus to handle carry on business as usual
+
+            // Fetch keypress, waking up now and then to show a save's progress,
+            // the line count going up or to catch up on the search index
+            int wait = -1;
+            if (saver.running() || indexer.running() || !LineBuffer.counted()) {
+                wait = 100;
+            } else if (indexer.enabled && indexer.outdated(LineBuffer)) {
+                wait = 1000;
+            }
+            if (follower) {
+                wait = 50;
+            }
+            if ((watch || (journal && journal->pending())) && (wait < 0 || wait > 1000)) {
+                wait = 1000;
+            }
+            key = terminal->getKey(wait);
+            Stats::Timer dispatch(Stats::KEY);
+            if (key != L && key != ERR) {
+                confirmReload = false;
+            }
+
+            // Process the keypress...
+            switch (key) {
+            // No key, the timeout ran out
+            case ERR:
+                dispatch.cancel();
+                break;
+            // Exit (^Q)
+            case Q:
+                MessageBarStatus = EXIT;
+                break;
+            // Find (^F)
+            case F:
+                MessageBarStatus = FIND;
+                break;
+            // Find and replace (^R)
+            case R:
+                MessageBarStatus = REPLACE;
+                break;
+            // Undo the last replace-all (^Z)
+            case Z:
+                if (undoReplace(LineBuffer, lastReplace)) {
+                    CURS_X = min(size_t(CURS_X), LineBuffer.length(CURS_Y));
+                    messageBar = "Replace undone";
+                } else {
+                    messageBar = "Nothing to undo, only a replace-all with no edits after it can be";
+                }
+                break;
+            // Go to a line (^G)
+            case G:
+                MessageBarStatus = GOTO;
+                break;
+            // Read the file again after another program changed it (^L)
+            case L:
+                if (fileName.empty() || follower || !fileExists(fileName)) {
+                    messageBar = "Nothing to reload";
+                } else if (LineBuffer.modified() && !confirmReload) {
+                    confirmReload = true;
+                    messageBar = "Reloading drops the unsaved changes, ^L again reloads";
+                } else {
+                    reloadFile();
+                }
+                break;
+            // Next open file (^N)
+            case N:
+                if (buffers.buffers.size() > 1) {
+                    switchBuffer((buffers.current + 1) % buffers.buffers.size());
+                } else {
+                    messageBar = "No other files open, ^O opens one";
+                }
+                break;
+            // Keep the end of a followed file on the screen or not (^A)
+            case A:
+                if (!follower) {
+                    messageBar = "Not following anything (soup - or soup --follow file)";
+                    break;
+                }
+                autoScroll = !autoScroll;
+                messageBar = autoScroll ? "Following the end" : "Not following the end, ^A goes back to it";
+                if (autoScroll) {
+                    goToLine(0);
+                }
+                break;
+            // Toggle the search index (^T)
+            case T:
+                indexer.enabled = !indexer.enabled;
+                if (indexer.enabled) {
+                    messageBar = "Building the search index...";
+                    announceIndex = true;
+                    indexer.start(LineBuffer);
+                } else {
+                    indexer.reset(LineBuffer);
+                    messageBar = "Search index off";
+                }
+                break;
+            // Save (^S)
+            case S:
+                MessageBarStatus = SAVE;
+                break;
+            // Show the timings (^P)
+            case P:
+                showTimings = !showTimings;
+                break;
+
+            // Backspace
+            case 127:
+            case KEY_BACKSPACE: {
+                Stats::Timer timing(Stats::EDIT);
+                // if the cursor is at the start of a line
+                if (CURS_X > 0) {
+                    // Delete the character before the cursor, all its bytes
+                    size_t start = Utf8::prev(LineBuffer.view(CURS_Y).data, CURS_X);
+                    LineBuffer.erase(CURS_Y, start, CURS_X - start);
+                    CURS_X = start;
+                } else {
+                    // Delete the line and change the one above the cursor
+                    if (CURS_Y > 0) {
+                        CURS_X = LineBuffer.length(CURS_Y - 1);
+                        LineBuffer.joinLines(CURS_Y - 1);
+                        CURS_Y--; // Change to the line above
+
+                        if (CURS_Y < lineArea && lineArea > 0)
+                            lineArea--;
+                    }
+                }
+                break;
+            }
+
+            // Enter
+            case ENTER: {
+                Stats::Timer timing(Stats::EDIT);
+                // Move the text on the right side of the cursor
+                // to a new line below
+                LineBuffer.splitLine(CURS_Y, CURS_X);
+
+                // Set correct  Y and X values
+                CURS_Y++;
+                if (CURS_Y >= MAX_Y - TOP_PADDING + lineArea) {
+                    lineArea++;
+                }
+                CURS_X = 0;
+
+                // Auto Indentation
+                CURS_X = spacesLastLine(CURS_Y);
+                LineBuffer.insertText(CURS_Y, 0, string(CURS_X, ' '));
+
+                break;
+            }
+            // Open a file
+            case O:
+                MessageBarStatus = OPEN;
+                break;
+            // Arrow keys
+            case KEY_LEFT:
+                if (CURS_X != 0) {
+                    CURS_X = Utf8::prev(LineBuffer.view(CURS_Y).data, CURS_X);
+                }
+                break;
+            case KEY_RIGHT:
+                if (CURS_X < LineBuffer.length(CURS_Y)) {
+                    LineView line = LineBuffer.view(CURS_Y);
+                    CURS_X = Utf8::next(line.data, line.size, CURS_X);
+                }
+                break;
+            // Up and down keep the cursor in the same column
+            case KEY_UP:
+                if (CURS_Y != 0) {
+                    size_t col = Utf8::column(LineBuffer.view(CURS_Y), CURS_X);
+                    CURS_Y--;
+                    CURS_X = Utf8::offsetAt(LineBuffer.view(CURS_Y), col);
+                    if (CURS_Y < lineArea && lineArea > 0) {
+                        lineArea--;
+                    }
+                }
+                break;
+            case KEY_DOWN:
+                LineBuffer.indexTo(CURS_Y + 2);
+                if (CURS_Y + 1 < LineBuffer.size()) {
+                    size_t col = Utf8::column(LineBuffer.view(CURS_Y), CURS_X);
+                    CURS_Y++;
+                    CURS_X = Utf8::offsetAt(LineBuffer.view(CURS_Y), col);
+                    if (CURS_Y >= MAX_Y - TOP_PADDING + lineArea) {
+                        lineArea++;
+                    }
+                }
+                break;
+
+            // TAB key (WIP)
+            case 9: {
+                Stats::Timer timing(Stats::EDIT);
+                LineBuffer.insertText(CURS_Y, CURS_X, string(4, ' '));
+                CURS_X += 4;
+                break;
+            }
+
+            // Bracketed paste, all of it in one go
+            case KEY_PASTE: {
+                Stats::Timer timing(Stats::EDIT);
+                pasteText(terminal->pasted);
+                break;
+            }
+
+            // Add the keypress to the current line if a regular keypress
+            default:
+                Stats::Timer timing(Stats::EDIT);
+                // Keys already waiting behind it (a paste the terminal
+                // didn't bracket) go in together
+                if (!pasteTypeahead(key)) {
+                    LineBuffer.insertChar(CURS_Y, CURS_X, char(key));
+                    CURS_X += 1;
+                }
+                break;
+            }
+        }
+    }
+
+    // Let a save that is still running finish
+    pollSave(true);
+    terminal = nullptr;
+
+    // Quitting means the changes were saved or dropped
+    if (journal) {
+        journal->remove();
+    }
+    for (OpenBuffer& b : buffers.buffers) {
+        if (b.journal)
+            b.journal->remove();
+    }
+}
+
+void updateScr()
+{
+    Stats::Timer timing(Stats::DRAW);
+    terminal->size(MAX_Y, MAX_X);
+    screen.begin(MAX_Y, MAX_X);
+
+    // Make sure the lines on the screen have been read
+    unsigned int textRows = MAX_Y > TOP_PADDING ? MAX_Y - TOP_PADDING : 0;
+    LineBuffer.indexTo(lineArea + textRows);
+
+    // Status bar
+    ScreenRow status;
+    char info[64];
+    snprintf(info, sizeof(info), " %i,%i L: %i%s",
+        int(Utf8::column(LineBuffer.view(CURS_Y), CURS_X)), CURS_Y,
+        int(LineBuffer.lineCount()), LineBuffer.counted() ? "" : "+");
+    status.text = fileName + (LineBuffer.modified() ? " [+]" : "") + info;
+    if (buffers.buffers.size() > 1) {
+        status.text += " (" + to_string(buffers.current + 1) + "/"
+            + to_string(buffers.buffers.size()) + ")";
+    }
+    if (follower) {
+        status.text += autoScroll ? " [following]" : " [following, paused]";
+    }
+    if (showTimings) {
+        status.text += " | " + Stats::overlay();
+    }
+    status.inverted = true;
+    screen.setRow(0, status);
+
+    // Message bar (for various uses)
+    ScreenRow message;
+    message.text = messageBar;
+    message.inverted = true;
+    screen.setRow(1, message);
+
+    // Horizontal line separating the main and top fields
+    ScreenRow rule;
+    rule.rule = true;
+    screen.setRow(2, rule);
+
+    // Only the lines that fit on the screen are visited
+    size_t last = min(LineBuffer.size(), size_t(lineArea) + textRows);
+
+    // Bring the lexer states up to the screen, which only lexes the lines
+    // that changed since the last frame (and the ones they changed)
+    Highlight::Language language = Highlight::languageOf(fileName);
+    uint8_t state = 0;
+    if (Highlight::carriesState(language)) {
+        LineBuffer.lexTo(last, language, [language](LineView view, uint8_t from) {
+            return Highlight::lex(language, view, from, nullptr);
+        });
+        state = LineBuffer.stateBefore(lineArea);
+    }
+
+    vector<uint8_t> colours;
+    size_t width = MAX_X > LEFT_PADDING ? MAX_X - LEFT_PADDING : 0;
+    LineBuffer.forEach(lineArea, last, [&](size_t i, LineView view) {
+        ScreenRow row;
+        row.text = to_string(i + 1);
+        row.text.resize(LEFT_PADDING, ' ');
+
+        // The cursor's line scrolls sideways, by columns, to keep the cursor
+        // on the screen. from is the byte the row starts at.
+        size_t from = 0;
+        if (i == CURS_Y && width > 0) {
+            size_t x = min(size_t(CURS_X), view.size);
+            size_t column = Utf8::column(view, x);
+            size_t cursorEnd = x < view.size
+                ? Utf8::column(view, Utf8::next(view.data, view.size, x))
+                : column + 1; // A cell of its own past the end of the line
+            if (cursorEnd > width) {
+                size_t skip = cursorEnd - width;
+                from = Utf8::offsetAt(view, skip);
+                if (from < x && Utf8::column(view, from) < skip) {
+                    from = Utf8::next(view.data, view.size, from); // Half off the screen
+                }
+            }
+        }
+        LineView shown = view;
+        if (from > 0) {
+            shown.data += from;
+            shown.size -= from;
+            shown.width -= uint32_t(Utf8::column(view, from));
+        }
+        Utf8::clip(shown, width, row.text);
+        if (i == CURS_Y) {
+            if (CURS_X >= view.size) {
+                row.text += ' ';
+            }
+            row.cursor = LEFT_PADDING + CURS_X - from;
+        }
+
+        // Clipping keeps byte offsets, so the colours line up with the text
+        if (language != Highlight::NONE) {
+            state = Highlight::lex(language, view, state, &colours);
+            row.colours.assign(LEFT_PADDING, Highlight::PLAIN);
+            size_t start = min(from, colours.size());
+            row.colours.insert(row.colours.end(), colours.begin() + start,
+                colours.begin() + min(colours.size(), start + row.text.length() - LEFT_PADDING));
+        }
+        screen.setRow(TOP_PADDING + (i - lineArea), move(row));
+    });
+
+    screen.present(*terminal);
+}
+
+// Handle the message bar's status
+void handleMsgBar(MsgBarStatus status)
+{
+    switch (status) {
+    // Save to a file
+    case SAVE: {
+        // initalize the message bar
+        messageBar = "File name: " + fileName;
+
+        updateScr();
+
+        // Sub routine loop
+        bool subRunning = true;
+        string fileNameBuffer = fileName;
+        while (subRunning) {
+            updateScr();
+            key = terminal->getKey();
+            switch (key) {
+            // Backspace
+            case 127:
+            case KEY_BACKSPACE:
+                // Delete the last character of the file name buffer
+                if (fileNameBuffer.length() > 0) {
+                    fileNameBuffer.pop_back();
+                }
+                break;
+            // Quit dialog (^Q)
+            case C:
+                subRunning = false;
+                break;
+            // Enter
+            case ENTER:
+                // set the file name to be the filename buffer
+                fileName = fileNameBuffer;
+                // Save the text to the given file name
+                startSave();
+                subRunning = false;
+                break;
+            case KEY_PASTE:
+                fileNameBuffer += pastedLine();
+                break;
+            default:
+                fileNameBuffer += key;
+            }
+            if (subRunning) {
+                messageBar = "File name: " + fileNameBuffer;
+            }
+        }
+
+        // Reset the message bar unless a save started
+        if (key != ENTER) {
+            messageBar = "";
+        }
+        MessageBarStatus = CLEAR;
+        break;
+    }
+    // Open a file by certain name
+    case OPEN: {
+        // Initialize the screen and messagebar
+        messageBar = "File to open: ";
+        updateScr();
+
+        bool subRunning = true;
+        string fileNameBuffer = "";
+        while (subRunning) {
+            updateScr();
+            key = terminal->getKey();
+            switch (key) {
+            // Backspace
+            case 127:
+            case KEY_BACKSPACE:
+                // Delete the last character of the file name buffer
+                if (fileNameBuffer.length() > 0) {
+                    fileNameBuffer.pop_back();
+                }
+                break;
+            // Quit dialog (^Q)
+            case C:
+                subRunning = false;
+                break;
+            // Enter
+            case ENTER:
+                // Open the file once the last one is saved
+                pollSave(true);
+                openBuffer(fileNameBuffer);
+                subRunning = false;
+                break;
+            case KEY_PASTE:
+                fileNameBuffer += pastedLine();
+                break;
+            default:
+                fileNameBuffer += key;
+            }
+            if (subRunning) {
+                messageBar = "File name: " + fileNameBuffer;
+            }
+        }
+        // Reset the message bar unless it says which file is open
+        if (key != ENTER) {
+            messageBar = "";
+        }
+        MessageBarStatus = CLEAR;
+        break;
+    }
+    case EXIT: {
+        // The other open files with changes are asked about one by one
+        if (!LineBuffer.modified() && buffers.modified() != string::npos) {
+            switchBuffer(buffers.modified());
+        }
+        bool again = false; // Ask about the next file with changes
+        bool refused = false; // The save didn't start, say why and stay
+
+        if (LineBuffer.modified()) {
+            bool subRunning = true;
+            messageBar = "Save changes before you exit? (Y/n/c: compare with the file)";
+            if (buffers.modified() != string::npos) {
+                messageBar = "Save changes to " + fileName
+                    + " before you exit? (Y/n: drop all changes/c: compare with the file)";
+            }
+            updateScr();
+            while (subRunning) {
+                key = terminal->getKey();
+                switch (key) {
+                case 121:
+                case ENTER:
+                    // Print the lineBuffer into the file
+                    // before exiting if 'y' or enter is pressed
+                    if (fileName != "") {
+                        refused = !startSave();
+                    } else {
+                        handleMsgBar(SAVE);
+                    }
+                    // Quit when the save is done
+                    exitAfterSave = saver.running();
+                    subRunning = false;
+                    running = exitAfterSave || refused;
+                    break;
+                case Q:
+                case 110:
+                    // if 'n' or ^Q is pressed don't save before exit
+                    subRunning = false;
+                    running = false;
+                    break;
+                case C:
+                    // Not working for some reason
+                    // ^C  was pressed which means cancel the dialog
+                    subRunning = false;
+                    break;
+                case 99:
+                    // 'c' compares the whole buffer with the file on disk
+                    if (fileExists(fileName) && LineBuffer.equals(getFileLines(fileName))) {
+                        LineBuffer.markSaved();
+                        subRunning = false;
+                        again = buffers.modified() != string::npos;
+                        running = again;
+                    } else {
+                        messageBar = "The buffer differs from the file. Save changes before you exit? (Y/n)";
+                        updateScr();
+                    }
+                    break;
+                }
+            }
+        } else {
+            running = false;
+        }
+
+        if (!exitAfterSave && !refused) {
+            messageBar = "";
+        }
+        MessageBarStatus = again ? EXIT : CLEAR;
+        break;
+    }
+    case FIND: {
+        messageBar = "Find?: ";
+        updateScr();
+
+        // Local varibales
+        bool subRunning = true;
+        bool regex = false; // ^E switches between plain text and patterns
+        string stringToFind = "";
+        size_t currentHit = 0;
+        searchResults.clear();
+
+        // Save the last start position of the cursor in case of cancel
+        int StartX = CURS_X;
+        int StartY = CURS_Y;
+        unsigned int StartArea = lineArea;
+
+        bool seekStart = false; // Still looking for the first hit after the start
+
+        // Sub-routine for the find functionality
+        while (subRunning) {
+            updateScr();
+
+            // Wake up for the hits of a search that's still running
+            key = terminal->getKey(searcher.done() ? -1 : 50);
+            bool queryChanged = false;
+            switch (key) {
+            // No key, just new hits
+            case ERR:
+                break;
+            // Backspace
+            case 127:
+            case KEY_BACKSPACE:
+                // Delete the last character of the file name buffer
+                if (stringToFind.length() > 0) {
+                    stringToFind.pop_back();
+                    queryChanged = true;
+                }
+                break;
+            // Quit dialog (^Q)
+            case C:
+                subRunning = false;
+                CURS_X = StartX;
+                CURS_Y = StartY;
+                lineArea = StartArea;
+                break;
+            // Toggle regular expressions (^E)
+            case E:
+                regex = !regex;
+                queryChanged = true;
+                break;
+            // Enter keeps the cursor on the current hit
+            case ENTER:
+                subRunning = false;
+                break;
+            // Increment the current search hit by 1
+            case KEY_DOWN:
+            case KEY_RIGHT:
+                if (currentHit + 1 < searchResults.size()) {
+                    currentHit++;
+                }
+                break;
+            // Decrease the current search hit by 1
+            case KEY_UP:
+            case KEY_LEFT:
+                if (currentHit > 0) {
+                    currentHit--;
+                }
+                break;
+            case KEY_PASTE:
+                stringToFind += pastedLine();
+                queryChanged = true;
+                break;
+            default:
+                stringToFind += key;
+                queryChanged = true;
+            }
+
+            if (!subRunning) {
+                break;
+            }
+
+            // Only a new query is searched for, moving between hits isn't
+            if (queryChanged) {
+                searchFile(stringToFind, regex);
+                currentHit = 0;
+                seekStart = true;
+            } else {
+                searcher.update(searchResults);
+            }
+
+            // Start from the first hit after where the search started
+            if (seekStart) {
+                while (currentHit < searchResults.size()
+                    && (searchResults[currentHit].y < size_t(StartY)
+                           || (searchResults[currentHit].y == size_t(StartY)
+                                  && searchResults[currentHit].x < size_t(StartX)))) {
+                    currentHit++;
+                }
+                if (currentHit < searchResults.size()) {
+                    seekStart = false;
+                } else if (searcher.done()) {
+                    currentHit = 0; // Nothing after the start, wrap around
+                    seekStart = false;
+                }
+            }
+
+            messageBar = (regex ? "Find (regex)?: " : "Find?: ") + stringToFind;
+            string more = searcher.done() ? "" : "+"; // Still searching
+            if (searchResults.size() > 0 && !seekStart) {
+                messageBar += " (" + to_string(currentHit + 1) + "/" + to_string(searchResults.size()) + more + ")";
+                CURS_X = searchResults[currentHit].x;
+                CURS_Y = searchResults[currentHit].y;
+                scrollToCursor();
+            } else if (!searcher.error.empty()) {
+                messageBar += " (" + searcher.error + ")";
+            } else if (!stringToFind.empty()) {
+                messageBar += searcher.done() ? " (no hits)" : " (searching...)";
+            }
+        }
+        searcher.reset(); // Stop a search that's still running
+
+        // Reset the message bar
+        messageBar = "";
+        MessageBarStatus = CLEAR;
+        break;
+    }
+    case REPLACE: {
+        bool regex = false;
+        string query, text;
+        MessageBarStatus = CLEAR;
+        messageBar = "";
+        if (!readAnswer("Replace", query, &regex) || query.empty()
+            || !readAnswer("Replace " + query + " with", text, nullptr)) {
+            messageBar = "";
+            break;
+        }
+
+        // Go through the hits from the cursor on
+        searchFile(query, regex);
+        searcher.wait(searchResults);
+        replaceableHits(LineBuffer, query, regex, searchResults);
+        size_t currentHit = 0;
+        while (currentHit < searchResults.size()
+            && (searchResults[currentHit].y < CURS_Y
+                   || (searchResults[currentHit].y == CURS_Y && searchResults[currentHit].x < CURS_X))) {
+            currentHit++;
+        }
+        if (currentHit == searchResults.size()) {
+            currentHit = 0;
+        }
+
+        size_t replaced = 0;
+        bool subRunning = !searchResults.empty();
+        messageBar = searcher.error.empty() ? "No hits for " + query : "Replace: " + searcher.error;
+        while (subRunning) {
+            SearchHit hit = searchResults[currentHit];
+            CURS_X = hit.x;
+            CURS_Y = hit.y;
+            scrollToCursor();
+            messageBar = "Replace with " + text + "? (" + to_string(currentHit + 1) + "/"
+                + to_string(searchResults.size()) + ") y: this one, n: the next, a: all";
+            updateScr();
+
+            key = terminal->getKey();
+            switch (key) {
+            // Replace this one and go to the next
+            case 'y': {
+                Stats::Timer timing(Stats::EDIT);
+                size_t length = matchLength(LineBuffer, hit, query, regex);
+                if (length == 0 || length == string::npos) {
+                    currentHit++;
+                } else {
+                    LineBuffer.erase(hit.y, hit.x, length);
+                    LineBuffer.insertText(hit.y, hit.x, text);
+                    replaced++;
+
+                    // The hits it covered are gone, the rest of the line moves
+                    size_t next = currentHit + 1, kept = currentHit;
+                    for (; next < searchResults.size() && searchResults[next].y == hit.y; next++) {
+                        SearchHit h = searchResults[next];
+                        if (h.x >= hit.x + length) {
+                            h.x = h.x - length + text.length();
+                            searchResults[kept++] = h;
+                        }
+                    }
+                    searchResults.erase(searchResults.begin() + kept, searchResults.begin() + next);
+                    CURS_X = hit.x + text.length();
+                }
+                break;
+            }
+            case 'n':
+            case KEY_DOWN:
+            case KEY_RIGHT:
+                currentHit++;
+                break;
+            case KEY_UP:
+            case KEY_LEFT:
+                currentHit = (currentHit > 0 ? currentHit : searchResults.size()) - 1;
+                break;
+            // Every match in the buffer in one go
+            case 'a': {
+                Stats::Timer timing(Stats::EDIT);
+                string error;
+                size_t count = replaceAll(LineBuffer, query, text, regex, lastReplace, error);
+                replaced += count;
+                subRunning = false;
+                break;
+            }
+            case C:
+            case ENTER:
+                subRunning = false;
+                break;
+            }
+
+            if (searchResults.empty()) {
+                subRunning = false;
+            } else if (currentHit >= searchResults.size()) {
+                currentHit = 0; // Wrap around
+            }
+            if (!subRunning) {
+                messageBar = "Replaced " + to_string(replaced) + (replaced == 1 ? " match" : " matches");
+                if (key == 'a' && replaced > 0) {
+                    messageBar += ", ^Z undoes the replace-all";
+                }
+            }
+        }
+        searcher.reset();
+        searchResults.clear();
+        CURS_X = min(size_t(CURS_X), LineBuffer.length(CURS_Y));
+        MessageBarStatus = CLEAR;
+        break;
+    }
+    case GOTO: {
+        messageBar = "Go to line (empty for the last): ";
+
+        bool subRunning = true;
+        string number = "";
+        while (subRunning) {
+            updateScr();
+            key = terminal->getKey();
+            switch (key) {
+            // Backspace
+            case 127:
+            case KEY_BACKSPACE:
+                if (number.length() > 0) {
+                    number.pop_back();
+                }
+                break;
+            // Quit dialog (^C)
+            case C:
+                subRunning = false;
+                break;
+            case ENTER:
+                goToLine(number.empty() ? 0 : strtoull(number.c_str(), nullptr, 10));
+                subRunning = false;
+                break;
+            case KEY_PASTE:
+                for (char c : pastedLine()) {
+                    if (c >= '0' && c <= '9')
+                        number += c;
+                }
+                break;
+            default:
+                // Only digits make sense here
+                if (key >= '0' && key <= '9') {
+                    number += char(key);
+                }
+            }
+            messageBar = "Go to line (empty for the last): " + number;
+        }
+        messageBar = "";
+        MessageBarStatus = CLEAR;
+        break;
+    }
+    case CLEAR:
+    default:
+        // not supposed to happen. Invalid value
+        break;
+    }
+}
+
+// Let the user type an answer to prompt into answer, false if cancelled.
+// With regex set ^E switches it on and off.
+bool readAnswer(const string& prompt, string& answer, bool* regex)
+{
+    while (true) {
+        messageBar = prompt + (regex && *regex ? " (regex)" : "") + "?: " + answer;
+        updateScr();
+        key = terminal->getKey();
+        switch (key) {
+        // Backspace
+        case 127:
+        case KEY_BACKSPACE:
+            if (answer.length() > 0) {
+                answer.pop_back();
+            }
+            break;
+        // Quit dialog (^C)
+        case C:
+            return false;
+        // Switch between text and patterns (^E)
+        case E:
+            if (regex) {
+                *regex = !*regex;
+            }
+            break;
+        case ENTER:
+            return true;
+        case KEY_PASTE:
+            answer += pastedLine();
+            break;
+        default:
+            if (key >= ' ' && key < 256) {
+                answer += char(key);
+            }
+        }
+    }
+}
+
+// Put text at the cursor. The lines of a paste are added in one go and the
+// screen is drawn once after it.
+void pasteText(const string& text)
+{
+    // Terminals send Return as \r, tabs become spaces like with the TAB key
+    string clean;
+    clean.reserve(text.length());
+    for (size_t i = 0; i < text.length(); i++) {
+        char c = text[i];
+        if (c == '\r') {
+            if (i + 1 < text.length() && text[i + 1] == '\n')
+                continue;
+            clean += '\n';
+        } else if (c == '\t') {
+            clean += "    ";
+        } else if (c == '\n' || (unsigned char)c >= ' ') {
+            clean += c;
+        }
+    }
+
+    size_t nl = clean.find('\n');
+    if (nl == string::npos) {
+        LineBuffer.insertText(CURS_Y, CURS_X, clean);
+        CURS_X += clean.length();
+        return;
+    }
+
+    // The first line of the paste ends the cursor's line and the text after
+    // the cursor goes to the end of the last one
+    string current = LineBuffer.line(CURS_Y);
+    string rest = current.substr(CURS_X);
+    LineBuffer.setLine(CURS_Y, current.substr(0, CURS_X) + clean.substr(0, nl));
+
+    vector<string> lines;
+    size_t start = nl + 1;
+    while ((nl = clean.find('\n', start)) != string::npos) {
+        lines.push_back(clean.substr(start, nl - start));
+        start = nl + 1;
+    }
+    string last = clean.substr(start);
+    lines.push_back(last + rest);
+    LineBuffer.insertLines(CURS_Y + 1, move(lines));
+
+    CURS_Y += count(clean.begin(), clean.end(), '\n');
+    CURS_X = last.length();
+    scrollToCursor();
+}
+
+// Take the keys that are already waiting after key and paste them together
+// with it, false if nothing was waiting
+bool pasteTypeahead(int key)
+{
+    string text(1, char(key));
+    int next;
+    while ((next = terminal->getKey(0)) != ERR) {
+        bool isText = (next >= ' ' && next < 256 && next != 127) || next == ENTER
+            || next == '\r' || next == '\t';
+        if (!isText) {
+            terminal->ungetKey(next);
+            break;
+        }
+        text += char(next);
+    }
+    if (text.length() == 1) {
+        return false;
+    }
+    pasteText(text);
+    return true;
+}
+
+// The first line of a paste, for the prompts
+string pastedLine()
+{
+    const string& text = terminal->pasted;
+    return text.substr(0, text.find_first_of("\r\n"));
+}
+
+// Follow fileName, the cursor stays on the last line as lines come in
+// until ^A. The follower reads all of the file, a mapping would crash the
+// editor if the file got truncated.
+void followFile()
+{
+    follower = make_shared<Follower>(fileName);
+    if (!follower->good()) {
+        messageBar = "Can't follow " + fileName + ": " + strerror(errno);
+        follower.reset();
+        return;
+    }
+    journal.reset(); // The file has what there is to know
+    watch.reset(); // It's meant to change
+    LineBuffer = TextBuffer();
+    CURS_X = CURS_Y = 0;
+    lineArea = 0;
+    autoScroll = true;
+    messageBar = "Following " + fileName + ", ^A stops scrolling";
+}
+
+// Read the buffer from fd as it comes in
+void followStream(int fd)
+{
+    follower = make_shared<Follower>(fd);
+    autoScroll = true;
+    messageBar = "Reading from stdin, ^A stops scrolling";
+}
+
+// Append the lines a followed file or pipe got since the last time
+void pollFollow()
+{
+    if (!follower) {
+        return;
+    }
+
+    vector<string> lines;
+    bool truncated;
+    bool replace = follower->replacesLast();
+    bool got = follower->take(lines, truncated);
+    if (truncated) {
+        // What was read so far isn't in the file any more, start over
+        bool indexing = indexer.enabled;
+        indexer.reset(LineBuffer);
+        indexer.enabled = indexing;
+        searcher.reset();
+        searchResults.clear();
+        lastReplace = Replacement();
+        LineBuffer = TextBuffer();
+        replace = true;
+        CURS_X = CURS_Y = 0;
+        lineArea = 0;
+        messageBar = fileName + " got shorter, following it from its start";
+    }
+    if (!got) {
+        if (follower->ended()) {
+            messageBar = "End of input";
+            follower.reset();
+            autoScroll = false;
+        }
+        return;
+    }
+
+    Stats::Timer timing(Stats::LOAD);
+    LineBuffer.indexAll(); // The new lines go after all of the file
+    bool clean = !LineBuffer.modified();
+    size_t y = LineBuffer.size();
+    if (replace) {
+        // Instead of the empty line a new buffer has
+        y--;
+        LineBuffer.setLine(y, lines[0]);
+        lines.erase(lines.begin());
+        y++;
+    }
+    LineBuffer.insertLines(y, move(lines));
+    if (clean) {
+        LineBuffer.markSaved(); // Only what is in the file (or the pipe) got added
+    }
+
+    if (autoScroll) {
+        // Bottom of the screen rather than the middle, like tail -f
+        terminal->size(MAX_Y, MAX_X);
+        unsigned int textRows = MAX_Y > TOP_PADDING ? MAX_Y - TOP_PADDING : 1;
+        CURS_Y = LineBuffer.size() - 1;
+        CURS_X = 0;
+        lineArea = CURS_Y + 1 > textRows ? CURS_Y + 1 - textRows : 0;
+    }
+}
+
+// Write the journal a batch at a time, at most once a second
+void pollJournal()
+{
+    if (!journal || !journal->pending()) {
+        return;
+    }
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    if (now - journalWritten < chrono::seconds(1)) {
+        return;
+    }
+    journal->flush();
+    journalWritten = now;
+}
+
+// Tell once when another program has changed the file
+void pollWatch()
+{
+    if (watch && !follower && watch->poll()) {
+        keepText();
+        messageBar = fileName + " changed on disk, ^L reloads it";
+    }
+}
+
+// The lines of a mapped file that another program writes in place would
+// change or vanish under the buffer, they are copied while they're good
+void keepText()
+{
+    for (TextBuffer* text : { &LineBuffer, &lastReplace.before }) {
+        if (text->mapped() && text->mapped()->isFile(fileName)) {
+            text->unmap();
+        }
+    }
+}
+
+// Read fileName again after another program changed it. Only the lines that
+// differ are changed, so the cursor and the scroll stay on the same text.
+void reloadFile()
+{
+    Stats::Timer timing(Stats::LOAD);
+
+    // A file written in place is compared with the text as it was before,
+    // not with the mapping of it that changed too
+    if (!watch || watch->check()) {
+        keepText();
+    }
+    if (watch) {
+        watch->remember();
+    }
+    TextBuffer fresh;
+    loadFile(fileName, fresh);
+
+    // Not an edit, the journal starts over from the file
+    LineBuffer.listen(nullptr);
+    if (journal) {
+        journal->remove();
+    }
+
+    vector<Hunk> hunks;
+    size_t changed = 0;
+    fresh.indexAll();
+    LineBuffer.indexAll();
+    if (diffLines(LineBuffer, fresh, hunks)) {
+        patchLines(LineBuffer, fresh, hunks);
+        for (const Hunk& h : hunks) {
+            changed += max(h.oldCount, h.newCount);
+        }
+        messageBar = "Reloaded " + fileName + ", " + to_string(changed) + " lines changed";
+    } else {
+        // Too different to patch, take the whole file
+        bool indexing = indexer.enabled;
+        indexer.reset(LineBuffer);
+        indexer.enabled = indexing;
+        LineBuffer = fresh;
+        messageBar = "Reloaded " + fileName;
+    }
+    LineBuffer.markSaved();
+    journal = make_shared<Journal>(fileName);
+    LineBuffer.listen(journal);
+
+    searcher.reset();
+    searchResults.clear();
+    lastReplace = Replacement();
+    confirmOverwrite = confirmReload = false;
+
+    // Keep the cursor and the top of the screen on the lines they were on
+    size_t top = movedLine(lineArea, hunks);
+    LineBuffer.indexTo(movedLine(CURS_Y, hunks) + 1);
+    CURS_Y = min(movedLine(CURS_Y, hunks), LineBuffer.size() - 1);
+    CURS_X = min(size_t(CURS_X), LineBuffer.length(CURS_Y));
+    lineArea = min(top, size_t(CURS_Y));
+    scrollToCursor();
+}
+
+// Hand a finished index build to the buffer. The edited leaves are indexed
+// again once there haven't been any keys for a second (idle).
+void pollIndex(bool idle)
+{
+    if (!indexer.enabled) {
+        return;
+    }
+
+    if (indexer.poll(LineBuffer)) {
+        if (announceIndex) {
+            messageBar = indexer.summary();
+            announceIndex = false;
+        }
+        Logging::logEntry(indexer.summary(), Logging::INFO);
+    }
+    if (idle && !indexer.running() && indexer.outdated(LineBuffer)) {
+        indexer.start(LineBuffer);
+    }
+}
+
+// Start saving the buffer into fileName in the background, false if it
+// didn't start
+bool startSave()
+{
+    // What another program wrote isn't written over without asking
+    if (watch && watch->file() == fileName && watch->check() && !confirmOverwrite) {
+        confirmOverwrite = true;
+        messageBar = fileName + " changed on disk since it was read, saving again writes over it, ^L reloads it";
+        return false;
+    }
+    // Writing over the file that's mapped would change the text being saved
+    if (!saver.running() && writesInPlace(fileName)) {
+        keepText();
+    }
+    if (!saver.start(fileName, LineBuffer)) {
+        messageBar = "Still saving " + saver.name + "...";
+        return false;
+    }
+    confirmOverwrite = false;
+    if (journal) {
+        journal->mark(); // The edits from here on go into the next journal
+    }
+    messageBar = "Saving " + fileName + "...";
+    return true;
+}
+
+// Finish a background save if it is done (or wait for it if block is set)
+void pollSave(bool block)
+{
+    if (!saver.running()) {
+        return;
+    }
+
+    if (!saver.finished() && !block) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "... %.1f MB written", saver.progress() / 1e6);
+        messageBar = "Saving " + saver.name + msg;
+        return;
+    }
+
+    // The snapshot's contents are on disk, even if the buffer changed since
+    TextBuffer* saved = nullptr;
+    shared_ptr<Journal>* savedJournal = nullptr;
+    shared_ptr<FileWatch>* savedWatch = nullptr;
+    size_t i = buffers.find(saver.name);
+    if (saver.name == fileName) {
+        saved = &LineBuffer;
+        savedJournal = &journal;
+        savedWatch = &watch;
+    } else if (i != string::npos && i != buffers.current && buffers.buffers[i].loaded) {
+        saved = &buffers.buffers[i].text; // Switched away from while saving
+        savedJournal = &buffers.buffers[i].journal;
+        savedWatch = &buffers.buffers[i].watch;
+    }
+    SaveStats stats = saver.wait(saved);
+    messageBar = stats.summary();
+
+    // The file is what was saved now, that isn't a change to tell about
+    if (stats.ok && savedWatch) {
+        if (*savedWatch && (*savedWatch)->file() == saver.name) {
+            (*savedWatch)->remember();
+        } else {
+            *savedWatch = make_shared<FileWatch>(saver.name);
+        }
+    }
+
+    // Only the edits made while saving are left to recover
+    if (stats.ok && savedJournal && *savedJournal) {
+        (*savedJournal)->saved(saver.name);
+    } else if (savedJournal && *savedJournal) {
+        (*savedJournal)->unmark(); // Nothing was saved, all of it is still to recover
+    } else if (stats.ok && saved == &LineBuffer) {
+        journal = make_shared<Journal>(fileName); // It has a name now
+        LineBuffer.listen(journal);
+    }
+
+    if (exitAfterSave) {
+        exitAfterSave = false;
+        if (stats.ok && buffers.modified() != string::npos) {
+            MessageBarStatus = EXIT; // On to the next file with changes
+        } else {
+            running = !stats.ok; // Stay to show why the save failed
+        }
+    }
+}
+
+// Put the cursor on line y (counting from 1), 0 or past the end goes to the
+// last line. Only the lines up to it are split out of the file.
+void goToLine(size_t y)
+{
+    if (y == 0) {
+        LineBuffer.indexAll();
+        y = LineBuffer.size();
+    } else {
+        LineBuffer.indexTo(y);
+        y = min(y, LineBuffer.size());
+    }
+    CURS_Y = y - 1;
+    CURS_X = 0;
+    scrollToCursor();
+}
+
+// Move the visible area so that the cursor's line is on the screen
+void scrollToCursor()
+{
+    unsigned int textRows = MAX_Y > TOP_PADDING ? MAX_Y - TOP_PADDING : 1;
+    if (CURS_Y < lineArea || CURS_Y >= lineArea + textRows) {
+        lineArea = CURS_Y > textRows / 2 ? CURS_Y - textRows / 2 : 0;
+    }
+}
+
+// Returns how many spaces were in front of the last line
+int spacesLastLine(int y)
+{
+    int counter = 0;
+    string line = LineBuffer.line(y - 1);
+
+    for (unsigned int i = 0; i < line.length(); i++) {
+        if (line.at(i) == ' ') {
+            counter++;
+        } else {
+            break;
+        }
+    }
+
+    return counter;
+}
+
+// Search a string in file and return results to variable searchResults
+void searchFile(string s, bool regex)
+{
+    Stats::Timer timing(Stats::SEARCH);
+    searcher.find(LineBuffer, s, searchResults, regex);
+}
@@ -0,0 +1,83 @@
+// editor.h
+#ifndef EDITOR_H
+#define EDITOR_H
+
+#include <string>
+#include <vector>
+
+#include "search.hpp"
+
+using namespace std;
+
+class Terminal; // terminal.hpp
+
+// Some constant values
+#define TOP_PADDING 3  // Padding to print the status bar
+#define LEFT_PADDING 4 // Padding fo the line numbers
+
+// Results of searchFile will be sotred into this array in order
+extern vector<SearchHit> searchResults;
+
+// Define the control key values
+#define Q 17
+#define S 19
+#define C 3
+#define O 15
+#define F 6
+#define G 7
+#define N 14
+#define E 5
+#define T 20
+#define P 16
+#define A 1
+#define R 18
+#define Z 26
+#define L 12
+#define ENTER int('\n')
+
+// Enum for the message bar's status
+enum MsgBarStatus { SAVE, OPEN, EXIT, FIND, REPLACE, GOTO, CLEAR };
+
+// Running the editor
+void loadEditor(const string& name);    // Start over with a file
+void runEditor(Terminal& term);         // Run until the user quits
+
+// Open files
+void addBuffer(const string& name);     // Open a file without showing it
+void openBuffer(const string& name);    // Show a file, opening it if needed
+void switchBuffer(size_t i);            // Show the i'th open file
+
+// General routines for the program
+void updateScr();                       // Updating the screen
+void handleMsgBar(MsgBarStatus status); // Handle the message bar's prompt
+bool readAnswer(const string& prompt, string& answer, bool* regex); // Type into a prompt
+int spacesLastLine(int y);
+void scrollToCursor();                  // Move lineArea to show the cursor
+void goToLine(size_t y);                // Move the cursor to a line (0: the last)
+bool startSave();                       // Save the buffer in the background
+void pollSave(bool block);              // Finish a background save
+void pollIndex(bool idle);              // Keep the search index up to date
+
+// Following text as it comes in
+void followFile();                      // Append what gets added to the file
+void followStream(int fd);              // Read the buffer from a pipe
+void pollFollow();                      // Append the lines that came in
+
+// Other programs changing the file
+void pollWatch();                       // Tell when the file changed on disk
+void keepText();                        // Stop reading a file written in place
+void reloadFile();                      // Read it again, changing only what differs
+
+// Crash recovery
+string startJournal();                  // Journal fileName's edits, recover old ones
+void pollJournal();                     // Write the latest edits to the journal
+
+// Pasting
+void pasteText(const string& text);     // Insert text with newlines at the cursor
+bool pasteTypeahead(int key);           // Paste the keys that are waiting
+string pastedLine();                    // First line of the last paste
+
+// Searching
+void searchFile(string s, bool regex = false);
+
+#endif // EDITOR_H
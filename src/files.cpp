@@ -15,32 +15,361 @@
 // lines.cpp
 
 // Include the libraries
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <ncurses.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 #include <vector>
 
 #include "files.hpp"
 #include "logging.hpp"
+#include "stats.hpp"
 
 using namespace std;
 
+namespace {
+
+// The live mappings, for the bus error handler to find. It can't take a
+// lock, so a mapping takes a free slot with a compare and swap.
+const size_t GUARDED = 256;
+atomic<MappedFile*> guarded[GUARDED];
+size_t pageSize = 4096;
+
+// A read past the end of a file that got shorter. The pages from there to
+// the end of the mapping are all gone, zeros are mapped over them and the
+// read is tried again.
+void onBusError(int, siginfo_t* info, void*)
+{
+    uintptr_t at = uintptr_t(info->si_addr);
+    for (size_t i = 0; i < GUARDED; i++) {
+        MappedFile* file = guarded[i].load(memory_order_acquire);
+        uintptr_t start = file ? uintptr_t(file->data()) : 0;
+        if (!file || at < start || at >= start + file->size()) {
+            continue;
+        }
+        uintptr_t page = at & ~uintptr_t(pageSize - 1);
+        if (mmap(reinterpret_cast<void*>(page), start + file->size() - page, PROT_READ,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0)
+            != MAP_FAILED) {
+            return;
+        }
+        break;
+    }
+    signal(SIGBUS, SIG_DFL); // Not one of ours, die like before
+}
+
+void guardMappings()
+{
+    pageSize = sysconf(_SC_PAGESIZE);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = onBusError;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGBUS, &action, nullptr);
+}
+} // namespace
+
+// Map a file into memory (files that can't be mapped give !good())
+MappedFile::MappedFile(const string& NAME)
+{
+    static once_flag guarding;
+    call_once(guarding, guardMappings);
+
+    int fd = open(NAME.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    // Empty files and things that aren't regular files can't be mapped
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            bytes = static_cast<const char*>(addr);
+            length = st.st_size;
+            device = st.st_dev;
+            inode = st.st_ino;
+        }
+    }
+    close(fd); // The mapping stays valid without the descriptor
+
+    // Without a slot it isn't guarded, the file gets read instead
+    for (slot = 0; bytes && slot < GUARDED; slot++) {
+        MappedFile* none = nullptr;
+        if (guarded[slot].compare_exchange_strong(none, this)) {
+            return;
+        }
+    }
+    if (bytes) {
+        munmap(const_cast<char*>(bytes), length);
+        bytes = nullptr;
+        length = 0;
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (bytes) {
+        guarded[slot].store(nullptr, memory_order_release);
+        munmap(const_cast<char*>(bytes), length);
+    }
+}
+
+bool MappedFile::isFile(const string& name) const
+{
+    struct stat st;
+    return bytes && stat(name.c_str(), &st) == 0 && st.st_dev == device && st.st_ino == inode;
+}
+
+// Gathers the buffer's runs into big vectored writes
+class RunWriter {
+public:
+    RunWriter(int fd, atomic<size_t>* progress)
+        : fd(fd)
+        , progress(progress)
+    {
+    }
+
+    void add(const char* data, size_t size)
+    {
+        iov[count].iov_base = const_cast<char*>(data);
+        iov[count].iov_len = size;
+        count++;
+        pending += size;
+        if (count == IOV_BATCH || pending >= BYTES_BATCH) {
+            flush();
+        }
+    }
+
+    // Write everything gathered so far, carrying on after partial writes
+    void flush()
+    {
+        struct iovec* next = iov;
+        int left = count;
+        while (ok && left > 0) {
+            ssize_t n = writev(fd, next, left);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                ok = false;
+                error = strerror(errno);
+                break;
+            }
+            written += n;
+            if (progress)
+                progress->store(written, memory_order_relaxed);
+
+            // Skip the buffers that were written completely
+            while (left > 0 && size_t(n) >= next->iov_len) {
+                n -= next->iov_len;
+                next++;
+                left--;
+            }
+            if (left > 0) {
+                next->iov_base = static_cast<char*>(next->iov_base) + n;
+                next->iov_len -= n;
+            }
+        }
+        count = 0;
+        pending = 0;
+    }
+
+    bool ok = true;
+    string error;
+    size_t written = 0;
+
+private:
+    static const int IOV_BATCH = 1024; // IOV_MAX on Linux
+    static const size_t BYTES_BATCH = 1 << 22;
+
+    int fd;
+    atomic<size_t>* progress; // Bytes written so far for other threads
+    struct iovec iov[IOV_BATCH];
+    int count = 0;
+    size_t pending = 0;
+};
+
+namespace {
+
+string directoryOf(const string& name)
+{
+    size_t slash = name.rfind('/');
+    return slash == string::npos ? "." : (slash == 0 ? "/" : name.substr(0, slash));
+}
+
+// The file a save of name goes into: the one a symlink points to, even if
+// it isn't there yet
+string targetOf(const string& name)
+{
+    char* real = realpath(name.c_str(), nullptr);
+    if (real) {
+        string target = real;
+        free(real);
+        return target;
+    }
+    char link[4096];
+    ssize_t n = readlink(name.c_str(), link, sizeof(link) - 1);
+    if (n <= 0) {
+        return name;
+    }
+    string target(link, n);
+    return target[0] == '/' ? target : directoryOf(name) + "/" + target;
+}
+
+// Can a new file be given the owner and group of the file st is about?
+bool canOwn(const struct stat& st)
+{
+    uid_t me = geteuid();
+    if (me == 0) {
+        return true;
+    }
+    if (st.st_uid != me) {
+        return false;
+    }
+    if (st.st_gid == getegid()) {
+        return true;
+    }
+    int n = getgroups(0, nullptr);
+    vector<gid_t> groups(n > 0 ? n : 0);
+    n = getgroups(groups.size(), groups.data());
+    return n > 0 && find(groups.begin(), groups.begin() + n, st.st_gid) != groups.begin() + n;
+}
+} // namespace
+
+bool writesInPlace(const string& NAME)
+{
+    // A new file in its place would leave the other names of the file (hard
+    // links) with the old text, or lose its owner. It can't be made at all
+    // in a directory that can't be written to.
+    string target = targetOf(NAME);
+    struct stat st;
+    if (stat(target.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    return st.st_nlink > 1 || !canOwn(st) || access(directoryOf(target).c_str(), W_OK | X_OK) != 0;
+}
+
 // Write the current LineBuffer to a file
-void writeToFile(string& NAME, vector<string> lines)
+//
+// The text goes to a temporary file next to the target which is synced and
+// renamed over it, so a crash mid-save leaves the old file in one piece (and
+// a buffer still mapping the old file keeps its text). A symlink is followed
+// and the file it points to is replaced. A file that can't be replaced (see
+// writesInPlace()) is written over instead.
+SaveStats writeToFile(string& NAME, const TextBuffer& lines, atomic<size_t>* progress)
 {
-    ofstream outfile;
-    outfile.open(NAME.c_str()); // Open the file for writing
+    Stats::Timer timing(Stats::SAVE);
+    SaveStats stats;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    string target = targetOf(NAME);
+    bool inPlace = writesInPlace(target);
+    string tmpName;
+    int fd;
+    if (inPlace) {
+        fd = open(target.c_str(), O_WRONLY | O_CLOEXEC);
+    } else {
+        tmpName = target + ".XXXXXX";
+        vector<char> tmpPath(tmpName.begin(), tmpName.end());
+        tmpPath.push_back('\0');
+        fd = mkstemp(tmpPath.data());
+        tmpName = tmpPath.data();
+    }
+    if (fd < 0) {
+        stats.error = strerror(errno);
+        Logging::logEntry("Couldn't create a file to save " + NAME + ": " + stats.error, Logging::WARN);
+        return stats;
+    }
+
+    // Keep the owner and the permissions of the file that is replaced
+    struct stat st;
+    if (!inPlace && stat(target.c_str(), &st) == 0) {
+        if (fchown(fd, st.st_uid, st.st_gid) != 0) {
+            Logging::logEntry("Couldn't keep the owner of " + NAME + ": " + strerror(errno),
+                Logging::WARN);
+        }
+        fchmod(fd, st.st_mode & 07777);
+    } else if (!inPlace) {
+        mode_t mask = umask(0);
+        umask(mask);
+        fchmod(fd, 0666 & ~mask);
+    }
+
+    // Stream the buffer straight out of its lines and mapping
+    RunWriter writer(fd, progress);
+    lines.forEachRun([&](const char* data, size_t size) {
+        writer.add(data, size);
+    });
+    writer.flush();
 
-    // Write the given line buffer into the file
-    for (unsigned int y = 0; y < lines.size(); y++) {
-        outfile << lines[y].substr(0, lines[y].length() - 1) << endl;
+    stats.ok = writer.ok;
+    stats.error = writer.error;
+    if (stats.ok && inPlace && ftruncate(fd, writer.written) != 0) {
+        stats.ok = false;
+        stats.error = strerror(errno);
     }
-    outfile.close(); // close the file after we are done
+    if (stats.ok && fsync(fd) != 0) {
+        stats.ok = false;
+        stats.error = strerror(errno);
+    }
+    close(fd);
+
+    if (stats.ok && !inPlace && rename(tmpName.c_str(), target.c_str()) != 0) {
+        stats.ok = false;
+        stats.error = strerror(errno);
+    }
+    if (!stats.ok) {
+        if (!inPlace) {
+            unlink(tmpName.c_str());
+        }
+        Logging::logEntry("Failed to save " + NAME + ": " + stats.error, Logging::WARN);
+        return stats;
+    }
+
+    // Make the rename itself durable
+    if (!inPlace) {
+        int dirFd = open(directoryOf(target).c_str(), O_RDONLY | O_DIRECTORY);
+        if (dirFd >= 0) {
+            fsync(dirFd);
+            close(dirFd);
+        }
+    }
+
+    stats.bytes = writer.written;
+    stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
     // Log the event
-    string msg = "Wrote " + to_string(lines.size()) + " lines into a file";
-    Logging::logEntry(msg, Logging::INFO);
+    if (Logging::enabled(Logging::INFO)) {
+        Logging::logEntry("Wrote " + to_string(lines.size()) + " lines into a file. " + stats.summary(),
+            Logging::INFO);
+    }
+    return stats;
+}
+
+string SaveStats::summary() const
+{
+    if (!ok) {
+        return "Save failed: " + error;
+    }
+
+    char msg[128];
+    double rate = seconds > 0 ? bytes / seconds : 0;
+    snprintf(msg, sizeof(msg), "Saved %.1f MB in %.3f s (%.1f MB/s)",
+        bytes / 1e6, seconds, rate / 1e6);
+    return msg;
 }
 
 // Check if a file exists
@@ -71,6 +400,7 @@ void printFile(string NAME)
 // Get a file's lines
 vector<string> getFileLines(string& NAME)
 {
+    Stats::Timer timing(Stats::LOAD);
     string line; // Buffer for the line
     vector<string> lines; // A buffer for the lines
     ifstream infile;
@@ -78,9 +408,32 @@ vector<string> getFileLines(string& NAME)
 
     // Write the file line-by-line to the lines variable
     while (getline(infile, line)) {
-        lines.push_back(line + " "); // Append every line to the LineBuffer
+        lines.push_back(line); // Append every line to the LineBuffer
     }
     infile.close(); // Close file stream
 
     return lines;
 }
+
+// Load a file into a buffer, mapping it when possible
+void loadFile(string& NAME, TextBuffer& buffer)
+{
+    shared_ptr<MappedFile> file = make_shared<MappedFile>(NAME);
+    if (file->good()) {
+        Stats::Timer timing(Stats::LOAD); // getFileLines times the other way
+        buffer.assign(file);
+        Logging::logEntry("Mapped file (" + NAME + ")\n \t\t\t Bytes: " + to_string(file->size()),
+            Logging::INFO);
+    } else {
+        buffer.assign(getFileLines(NAME));
+        Logging::logEntry("Loaded file (" + NAME + ")\n \t\t\t Lines: " + to_string(buffer.size()),
+            Logging::INFO);
+    }
+
+    // If the file is empty add a line to prevent segFaults, it's not an edit
+    buffer.indexTo(1);
+    if (buffer.size() < 1) {
+        buffer.insertLine(0, "");
+        buffer.markSaved();
+    }
+}
@@ -3,17 +3,65 @@
 #define FILES_H
 
 // Include the libraries
+#include <atomic>
 #include <fstream>
 #include <string.h>
+#include <sys/types.h>
 #include <vector>
 
+#include "buffer.hpp"
+
 using namespace std;
 
+// A read-only memory mapping of a whole file
+//
+// Another program can make the file shorter under the mapping, and reading
+// the pages past its new end would kill the editor with a bus error. The
+// mappings are guarded: a bus error on one of them maps zeros over the rest
+// of it, so the text that was cut off reads as zeros instead. The editor
+// copies the text out of a mapping (TextBuffer::unmap()) as soon as it
+// notices the file changing in place, so it's only ever seen if the file
+// was cut before that.
+class MappedFile {
+public:
+    explicit MappedFile(const string& NAME);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool good() const { return bytes != nullptr; }
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+    bool isFile(const string& name) const; // Is this what's under name now?
+
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+    dev_t device = 0;
+    ino_t inode = 0;
+    size_t slot = 0; // Where the bus error handler finds it
+};
+
+// What happened while saving a file
+struct SaveStats {
+    bool ok = false;
+    size_t bytes = 0; // Bytes written
+    double seconds = 0; // Time from opening to renaming the file
+    string error; // Why the save failed
+
+    string summary() const; // Human readable result with the rate
+};
+
 // File Functions
 bool fileExists(string& NAME); // Checks if there exists a file with a name
 int getFileLength(ifstream file); // Get file's size (bytes, lines)
 vector<string> getFileLines(string& NAME); // Load a file
-void writeToFile(string& NAME, vector<string> lines); // Write to file
+void loadFile(string& NAME, TextBuffer& buffer); // Load a file into a buffer
+// Does a save write over the file rather than replace it? A buffer that
+// maps the file has to be unmapped first then.
+bool writesInPlace(const string& NAME);
+SaveStats writeToFile(string& NAME, const TextBuffer& lines,
+    atomic<size_t>* progress = nullptr); // Write to file
 void printFile(string NAME); // Write buffer to file
 
 #endif // FILES_H
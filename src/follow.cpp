@@ -0,0 +1,212 @@
+/*
+*    TextSoup, Yet another text editor
+*    Copyright (C) 2017  Jyry Hjelt
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*/
+// follow.cpp
+
+// Include the libraries
+#include <errno.h>
+#include <fcntl.h>
+#include <mutex>
+#include <poll.h>
+#include <string.h>
+#include <string>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "follow.hpp"
+
+using namespace std;
+
+namespace {
+const size_t CHUNK = 1 << 20; // Bytes read at a time
+}
+
+Follower::Follower(int FD)
+    : fd(FD)
+{
+    start();
+}
+
+Follower::Follower(const string& name)
+    : file(true)
+{
+    fd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    // Without inotify the file is looked at twice a second
+    notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (notify >= 0 && inotify_add_watch(notify, name.c_str(), IN_MODIFY) < 0) {
+        close(notify);
+        notify = -1;
+    }
+    start();
+}
+
+Follower::~Follower()
+{
+    if (reader.joinable()) {
+        char stop = 0;
+        while (write(wake[1], &stop, 1) < 0 && errno == EINTR) {
+        }
+        reader.join();
+    }
+    for (int d : { fd, notify, wake[0], wake[1] }) {
+        if (d >= 0)
+            close(d);
+    }
+}
+
+bool Follower::take(vector<string>& lines, bool& truncated)
+{
+    lock_guard<mutex> guard(lock);
+    truncated = shortened;
+    shortened = false;
+    if (truncated) {
+        resumes = true; // The buffer starts over, even if nothing came in yet
+    }
+    lines.clear();
+    lines.swap(pending);
+    if (lines.empty()) {
+        return false;
+    }
+    resumes = false;
+    return true;
+}
+
+void Follower::start()
+{
+    if (pipe2(wake, O_CLOEXEC) != 0) {
+        close(fd);
+        fd = -1;
+        return;
+    }
+    reader = thread([this]() { run(); });
+}
+
+void Follower::run()
+{
+    vector<char> buffer(CHUNK);
+    int watched = file ? notify : fd;
+    while (true) {
+        // A file is read up to its end first, what was added before the
+        // watch started counts too
+        if (file && !readMore(buffer)) {
+            break;
+        }
+
+        pollfd fds[2] = { { watched, POLLIN, 0 }, { wake[0], POLLIN, 0 } };
+        int ready = poll(fds, 2, watched >= 0 ? -1 : 500);
+        if (ready < 0 && errno != EINTR) {
+            break;
+        }
+        if (fds[1].revents) {
+            return; // Stopped, a stream that got cut off isn't finished
+        }
+        if (!fds[0].revents) {
+            continue;
+        }
+
+        if (file) {
+            // What changed doesn't matter, the file is read to its end anyway
+            char events[4096];
+            while (read(notify, events, sizeof(events)) > 0) {
+            }
+        } else if (!readMore(buffer)) {
+            break;
+        }
+    }
+
+    // The last line of a stream doesn't need a newline
+    if (!partial.empty()) {
+        vector<string> last(1, move(partial));
+        publish(last);
+    }
+    finished.store(true, memory_order_release);
+}
+
+bool Follower::readMore(vector<char>& buffer)
+{
+    vector<string> lines;
+    if (!file) {
+        ssize_t n = read(fd, buffer.data(), buffer.size());
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+            return true;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        split(buffer.data(), n, lines);
+        publish(lines);
+        return true;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && uint64_t(info.st_size) < offset) {
+        // Truncated (like a log that was rotated by copying), start over.
+        // The lines not taken yet are gone from the file too.
+        offset = 0;
+        partial.clear();
+        lock_guard<mutex> guard(lock);
+        pending.clear();
+        shortened = true;
+    }
+
+    ssize_t n;
+    while ((n = pread(fd, buffer.data(), buffer.size(), offset)) > 0) {
+        offset += n;
+        split(buffer.data(), n, lines);
+        publish(lines);
+    }
+    return true;
+}
+
+void Follower::split(const char* data, size_t n, vector<string>& lines)
+{
+    const char* end = data + n;
+    while (data < end) {
+        const char* nl = static_cast<const char*>(memchr(data, '\n', end - data));
+        if (!nl) {
+            partial.append(data, end - data);
+            break;
+        }
+        if (partial.empty()) {
+            lines.emplace_back(data, nl - data);
+        } else {
+            partial.append(data, nl - data);
+            lines.push_back(move(partial));
+            partial.clear();
+        }
+        data = nl + 1;
+    }
+}
+
+void Follower::publish(vector<string>& lines)
+{
+    if (lines.empty()) {
+        return;
+    }
+    lock_guard<mutex> guard(lock);
+    if (pending.empty()) {
+        pending.swap(lines);
+    } else {
+        pending.insert(pending.end(), make_move_iterator(lines.begin()),
+            make_move_iterator(lines.end()));
+    }
+    lines.clear();
+}
@@ -0,0 +1,65 @@
+// follow.hpp
+#ifndef FOLLOW_H
+#define FOLLOW_H
+
+// Reading text that keeps coming: a pipe on stdin or a growing file
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Reads on its own thread and cuts what it reads into whole lines, which
+// the editor takes from time to time and appends to the buffer. A file is
+// read from its start and then watched with inotify, only the bytes added
+// to it are read. Nothing of it is memory mapped, so it can be truncated
+// under the editor. A line that hasn't got its newline yet is held back
+// (at the end of a stream it comes out as it is).
+class Follower {
+public:
+    explicit Follower(int fd); // Read a stream until it ends, fd is closed after
+    explicit Follower(const string& name); // Read a file and what is added to it
+    ~Follower(); // Stops reading
+    Follower(const Follower&) = delete;
+    Follower& operator=(const Follower&) = delete;
+
+    bool good() const { return fd >= 0; }
+    bool ended() const { return finished.load(memory_order_acquire); }
+
+    // The first line taken next should replace the empty line of a new
+    // buffer: nothing was taken yet, or the file got shorter since
+    bool replacesLast() const { return resumes; }
+
+    // Move the lines that came in since the last call into lines, false if
+    // none did. truncated tells if the file got shorter in the meantime,
+    // it's read from the start again then and lines only has what's in it
+    // now: the lines taken before have to be dropped.
+    bool take(vector<string>& lines, bool& truncated);
+
+private:
+    int fd = -1;
+    bool file = false;
+    bool resumes = true; // Until lines are taken, from the start of the file
+    uint64_t offset = 0; // Where the next read from the file starts
+    int notify = -1; // inotify descriptor, for a file
+    int wake[2] = { -1, -1 }; // A pipe that stops the reader
+
+    mutex lock; // Guards pending and shortened
+    vector<string> pending; // Lines read and not taken yet
+    bool shortened = false;
+    string partial; // The line being read, only the reader touches it
+
+    atomic<bool> finished{ false };
+    thread reader;
+
+    void start();
+    void run();
+    bool readMore(vector<char>& buffer); // Read what there is, false at the end of a stream
+    void split(const char* data, size_t n, vector<string>& lines); // Into whole lines
+    void publish(vector<string>& lines); // Hand lines over to take()
+};
+
+#endif // FOLLOW_H
@@ -0,0 +1,294 @@
+/*
+*    TextSoup, Yet another text editor
+*    Copyright (C) 2017  Jyry Hjelt
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*/
+// highlight.cpp
+
+// Include the libraries
+#include <algorithm>
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "highlight.hpp"
+
+using namespace std;
+using namespace Highlight;
+
+namespace {
+
+// States of the C lexer at the end of a line
+enum CState : uint8_t {
+    C_NORMAL,
+    C_COMMENT, // Inside /* */
+    C_DIRECTIVE // A # line going on after a backslash
+};
+
+// Sorted, they are binary searched
+const char* const cKeywords[] = {
+    "alignas", "alignof", "asm", "break", "case", "catch", "class", "const", "const_cast",
+    "constexpr", "continue", "decltype", "default", "delete", "do", "dynamic_cast", "else",
+    "enum", "explicit", "export", "extern", "false", "final", "for", "friend", "goto", "if",
+    "inline", "mutable", "namespace", "new", "noexcept", "nullptr", "operator", "override",
+    "private", "protected", "public", "register", "reinterpret_cast", "return", "sizeof",
+    "static", "static_assert", "static_cast", "struct", "switch", "template", "this", "throw",
+    "true", "try", "typedef", "typeid", "typename", "union", "using", "virtual", "volatile",
+    "while",
+};
+const char* const cTypes[] = {
+    "auto", "bool", "char", "char16_t", "char32_t", "double", "float", "int", "int16_t",
+    "int32_t", "int64_t", "int8_t", "long", "short", "signed", "size_t", "ssize_t", "string",
+    "uint16_t", "uint32_t", "uint64_t", "uint8_t", "unsigned", "void", "wchar_t",
+};
+
+template <size_t N>
+bool isWord(const char* const (&words)[N], const char* s, size_t n)
+{
+    const char* const* w = lower_bound(words, words + N, s,
+        [n](const char* word, const char* text) { return strncmp(word, text, n) < 0; });
+    return w != words + N && strlen(*w) == n && memcmp(*w, s, n) == 0;
+}
+
+// Only ASCII counts, the bytes of other characters are left alone
+bool isDigit(char c) { return c >= '0' && c <= '9'; }
+bool isAlpha(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
+bool isAlnum(char c) { return isAlpha(c) || isDigit(c); }
+
+void paint(vector<uint8_t>* colours, size_t from, size_t to, Colour colour)
+{
+    if (colours && colour != PLAIN) {
+        fill(colours->begin() + from, colours->begin() + to, uint8_t(colour));
+    }
+}
+
+// End of a string or character literal opened at s[i]
+size_t quoted(const char* s, size_t n, size_t i)
+{
+    char quote = s[i];
+    for (i++; i < n; i++) {
+        if (s[i] == '\\')
+            i++;
+        else if (s[i] == quote)
+            return i + 1;
+    }
+    return n;
+}
+
+// End of the number at s[i]: digits, letters for hex and suffixes, and the
+// sign of an exponent
+size_t number(const char* s, size_t n, size_t i)
+{
+    for (i++; i < n; i++) {
+        char c = s[i];
+        bool sign = (c == '+' || c == '-') && (s[i - 1] == 'e' || s[i - 1] == 'E');
+        if (!isAlnum(c) && c != '.' && c != '\'' && !sign)
+            break;
+    }
+    return i;
+}
+
+uint8_t lexC(const char* s, size_t n, uint8_t state, vector<uint8_t>* colours)
+{
+    size_t i = 0;
+    if (state == C_COMMENT) {
+        const char* end = static_cast<const char*>(memmem(s, n, "*/", 2));
+        if (!end) {
+            paint(colours, 0, n, COMMENT);
+            return C_COMMENT;
+        }
+        i = end - s + 2;
+        paint(colours, 0, i, COMMENT);
+    }
+
+    // A # as the first thing on a line starts a directive
+    bool directive = state == C_DIRECTIVE;
+    if (!directive) {
+        size_t first = i;
+        while (first < n && (s[first] == ' ' || s[first] == '\t'))
+            first++;
+        directive = first < n && s[first] == '#';
+    }
+    Colour plain = directive ? PREPROC : PLAIN;
+
+    while (i < n) {
+        char c = s[i];
+        size_t end = i + 1;
+        Colour colour = plain;
+        if (c == '/' && end < n && s[end] == '/') {
+            paint(colours, i, n, COMMENT);
+            return C_NORMAL;
+        } else if (c == '/' && end < n && s[end] == '*') {
+            const char* close = static_cast<const char*>(memmem(s + i + 2, n - i - 2, "*/", 2));
+            if (!close) {
+                paint(colours, i, n, COMMENT);
+                return C_COMMENT;
+            }
+            end = close - s + 2;
+            colour = COMMENT;
+        } else if (c == '"' || c == '\'') {
+            end = quoted(s, n, i);
+            colour = STRING;
+        } else if (isDigit(c) || (c == '.' && end < n && isDigit(s[end]))) {
+            end = number(s, n, i);
+            colour = NUMBER;
+        } else if (isAlpha(c)) {
+            while (end < n && isAlnum(s[end]))
+                end++;
+            // Words don't change the state, only look them up to colour them
+            if (colours && !directive && isWord(cKeywords, s + i, end - i))
+                colour = KEYWORD;
+            else if (colours && !directive && isWord(cTypes, s + i, end - i))
+                colour = TYPE;
+        }
+        paint(colours, i, end, colour);
+        i = end;
+    }
+    return directive && n > 0 && s[n - 1] == '\\' ? C_DIRECTIVE : C_NORMAL;
+}
+
+void lexJson(const char* s, size_t n, vector<uint8_t>* colours)
+{
+    for (size_t i = 0; i < n;) {
+        char c = s[i];
+        size_t end = i + 1;
+        Colour colour = PLAIN;
+        if (c == '"') {
+            end = quoted(s, n, i);
+            // A string followed by a colon is a key
+            size_t after = end;
+            while (after < n && (s[after] == ' ' || s[after] == '\t'))
+                after++;
+            colour = after < n && s[after] == ':' ? TYPE : STRING;
+        } else if (isDigit(c) || c == '-') {
+            end = number(s, n, i);
+            colour = NUMBER;
+        } else if (isAlpha(c)) {
+            while (end < n && isAlnum(s[end]))
+                end++;
+            static const char* const literals[] = { "false", "null", "true" };
+            if (isWord(literals, s + i, end - i))
+                colour = KEYWORD;
+        }
+        paint(colours, i, end, colour);
+        i = end;
+    }
+}
+
+// The level a word in a log names, if it names one
+Colour logLevel(const char* s, size_t n)
+{
+    if (n > 8) {
+        return PLAIN;
+    }
+    char word[9];
+    for (size_t i = 0; i < n; i++) {
+        word[i] = s[i] >= 'a' && s[i] <= 'z' ? s[i] - 'a' + 'A' : s[i];
+    }
+    word[n] = '\0';
+
+    static const char* const errors[] = { "CRIT", "CRITICAL", "ERR", "ERROR", "FATAL", "PANIC", "SEVERE" };
+    static const char* const warnings[] = { "WARN", "WARNING" };
+    static const char* const infos[] = { "DEBUG", "INFO", "NOTICE", "TRACE" };
+    if (isWord(errors, word, n))
+        return LEVEL_ERROR;
+    if (isWord(warnings, word, n))
+        return LEVEL_WARNING;
+    if (isWord(infos, word, n))
+        return LEVEL_INFO;
+    return PLAIN;
+}
+
+bool separator(char c)
+{
+    return c == '.' || c == ':' || c == '-' || c == '/' || c == ',';
+}
+
+void lexLog(const char* s, size_t n, vector<uint8_t>* colours)
+{
+    for (size_t i = 0; i < n;) {
+        char c = s[i];
+        size_t end = i + 1;
+        Colour colour = PLAIN;
+        if (c == '"') {
+            end = quoted(s, n, i);
+            colour = STRING;
+        } else if (isDigit(c)) {
+            // Dates and times are one number: 2017-10-17 21:25:09.123
+            while (end < n && (isDigit(s[end]) || (separator(s[end]) && end + 1 < n && isDigit(s[end + 1]))))
+                end++;
+            colour = NUMBER;
+        } else if (isAlpha(c)) {
+            while (end < n && isAlnum(s[end]))
+                end++;
+            colour = logLevel(s + i, end - i);
+        }
+        paint(colours, i, end, colour);
+        i = end;
+    }
+}
+} // namespace
+
+namespace Highlight {
+
+Language languageOf(const string& fileName)
+{
+    size_t slash = fileName.rfind('/');
+    size_t dot = fileName.rfind('.');
+    if (dot == string::npos || (slash != string::npos && dot < slash)) {
+        return NONE;
+    }
+    string extension = fileName.substr(dot + 1);
+    for (char& c : extension) {
+        c = tolower(c);
+    }
+
+    static const char* const cExtensions[] = { "c", "cc", "cpp", "cxx", "h", "hh", "hpp", "hxx", "ino" };
+    if (isWord(cExtensions, extension.data(), extension.length())) {
+        return CPP;
+    }
+    if (extension == "json") {
+        return JSON;
+    }
+    if (extension == "log") {
+        return LOG;
+    }
+    return NONE;
+}
+
+bool carriesState(Language language)
+{
+    return language == CPP;
+}
+
+uint8_t lex(Language language, LineView line, uint8_t state, vector<uint8_t>* colours)
+{
+    if (colours) {
+        colours->assign(line.size, PLAIN);
+    }
+    switch (language) {
+    case CPP:
+        return lexC(line.data, line.size, state, colours);
+    case JSON:
+        lexJson(line.data, line.size, colours);
+        break;
+    case LOG:
+        lexLog(line.data, line.size, colours);
+        break;
+    case NONE:
+        break;
+    }
+    return 0;
+}
+} // Highlight
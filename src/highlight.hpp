@@ -0,0 +1,49 @@
+// highlight.hpp
+#ifndef HIGHLIGHT_H
+#define HIGHLIGHT_H
+
+// Syntax highlighting for a few kinds of files
+//
+// A lexer goes through one line at a time and only carries a small state
+// from a line to the next (like being inside a block comment). The buffer
+// keeps that state for every line (TextBuffer::lexTo), so after an edit
+// only the lines up to where the states agree again are lexed, and colours
+// are only worked out for the rows on the screen.
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "buffer.hpp"
+
+using namespace std;
+
+namespace Highlight {
+
+// What a byte is drawn as, every colour but PLAIN has a colour pair
+enum Colour : uint8_t {
+    PLAIN,
+    KEYWORD,
+    TYPE,
+    STRING,
+    NUMBER,
+    COMMENT,
+    PREPROC,
+    LEVEL_ERROR, // Log levels
+    LEVEL_WARNING,
+    LEVEL_INFO,
+    COLOURS
+};
+
+enum Language { NONE = -1, CPP, JSON, LOG };
+
+// The language of a file by its extension (C and C++ are both CPP)
+Language languageOf(const string& fileName);
+
+// Does the state carry over lines? If not every line starts in state 0.
+bool carriesState(Language language);
+
+// Lex a line starting in state and give the state at its end. colours, if
+// given, gets a colour for every byte of the line.
+uint8_t lex(Language language, LineView line, uint8_t state, vector<uint8_t>* colours);
+} // Highlight
+#endif // HIGHLIGHT_H
@@ -0,0 +1,419 @@
+/*
+*    TextSoup, Yet another text editor
+*    Copyright (C) 2017  Jyry Hjelt
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*/
+// journal.cpp
+
+// Include the libraries
+#include <errno.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "journal.hpp"
+#include "logging.hpp"
+
+using namespace std;
+
+// An edit is a letter and its numbers, texts are a length and the bytes:
+//   i y x text    insert text at x in line y
+//   e y x n       erase n bytes at x in line y
+//   s y text      set line y
+//   l y n text... insert n lines before line y
+//   d y           erase line y
+// Numbers are 7 bits a byte, lowest first, with the top bit on all but the
+// last byte.
+namespace {
+
+const char MAGIC[] = "textSoup journal 2\n";
+
+void putNumber(string& out, uint64_t n)
+{
+    while (n >= 0x80) {
+        out += char((n & 0x7F) | 0x80);
+        n >>= 7;
+    }
+    out += char(n);
+}
+
+void putText(string& out, const char* text, size_t n)
+{
+    putNumber(out, n);
+    out.append(text, n);
+}
+
+// Read what was put, false if the journal ends first
+bool getNumber(const string& in, size_t& at, uint64_t& n)
+{
+    n = 0;
+    for (int shift = 0; at < in.size() && shift < 64; shift += 7) {
+        unsigned char c = in[at++];
+        n |= uint64_t(c & 0x7F) << shift;
+        if (!(c & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool getText(const string& in, size_t& at, string& text)
+{
+    uint64_t n;
+    if (!getNumber(in, at, n) || n > in.size() - at) {
+        return false;
+    }
+    text.assign(in, at, n);
+    at += n;
+    return true;
+}
+
+bool writeAll(int fd, const string& data)
+{
+    for (size_t done = 0; done < data.size();) {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+// Take the lock of the journal open in fd, false if another editor has it
+bool lock(int fd)
+{
+    return flock(fd, LOCK_EX | LOCK_NB) == 0;
+}
+
+// Is there a journal at path that another editor holds?
+bool held(const string& path)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool free = lock(fd);
+    close(fd);
+    return !free;
+}
+
+// Make the edit at in[at] on buffer, false if it doesn't fit the buffer
+bool replay(const string& in, size_t& at, TextBuffer& buffer)
+{
+    char op = in[at++];
+    uint64_t y, x, n;
+    string text;
+    if (!getNumber(in, at, y)) {
+        return false;
+    }
+    buffer.indexTo(y + 2); // The lines have to be there to be edited
+    bool there = y < buffer.size();
+
+    switch (op) {
+    case 'i':
+        if (!getNumber(in, at, x) || !getText(in, at, text) || !there || x > buffer.length(y))
+            return false;
+        buffer.insertText(y, x, text);
+        return true;
+    case 'e':
+        if (!getNumber(in, at, x) || !getNumber(in, at, n) || !there || x + n > buffer.length(y))
+            return false;
+        buffer.erase(y, x, n);
+        return true;
+    case 's':
+        if (!getText(in, at, text) || !there)
+            return false;
+        buffer.setLine(y, text);
+        return true;
+    case 'l': {
+        if (!getNumber(in, at, n) || y > buffer.size())
+            return false;
+        vector<string> lines;
+        for (uint64_t i = 0; i < n; i++) {
+            if (!getText(in, at, text))
+                return false;
+            lines.push_back(move(text));
+        }
+        buffer.insertLines(y, move(lines));
+        return true;
+    }
+    case 'd':
+        if (!there)
+            return false;
+        buffer.eraseLine(y);
+        return true;
+    }
+    return false;
+}
+} // namespace
+
+Journal::Journal(const string& NAME)
+    : name(NAME)
+    , path(pathFor(NAME))
+{
+}
+
+Journal::~Journal()
+{
+    flush();
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+string Journal::pathFor(const string& name)
+{
+    size_t slash = name.rfind('/');
+    if (slash == string::npos) {
+        return "." + name + ".swp";
+    }
+    return name.substr(0, slash + 1) + "." + name.substr(slash + 1) + ".swp";
+}
+
+string Journal::header(const string& name)
+{
+    // A journal only fits the file as it was when the journal was started
+    struct stat info;
+    string out = MAGIC;
+    if (stat(name.c_str(), &info) != 0) {
+        putNumber(out, 0);
+        return out;
+    }
+    putNumber(out, 1);
+    putNumber(out, info.st_size);
+    putNumber(out, info.st_mtim.tv_sec);
+    putNumber(out, info.st_mtim.tv_nsec);
+    return out;
+}
+
+long Journal::recover(TextBuffer& buffer, string& why)
+{
+    fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0) {
+        why = "no journal";
+        return -1;
+    }
+    if (!lock(fd)) {
+        close(fd);
+        fd = -1;
+        busy = true;
+        why = path + " is in use by another editor, no journal is kept";
+        return -1;
+    }
+    ifstream in(path.c_str(), ios::binary);
+    string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+    string expected = header(name);
+    if (data.compare(0, expected.size(), expected) != 0) {
+        // Keep it around, it may still have something somebody wants
+        string old = path + ".old";
+        rename(path.c_str(), old.c_str());
+        close(fd);
+        fd = -1;
+        why = name + " changed after " + path + " was written, it was moved to " + old;
+        return -1;
+    }
+
+    // Whatever comes after the last whole edit was cut off by the crash
+    long edits = 0;
+    size_t at = expected.size(), good = at;
+    while (at < data.size() && replay(data, at, buffer)) {
+        good = at;
+        edits++;
+    }
+    if (good < data.size()) {
+        Logging::logEntry("Stopped recovering " + name + " at byte " + to_string(good)
+                + " of " + to_string(data.size()) + " of its journal",
+            Logging::WARN);
+    }
+
+    if (ftruncate(fd, good) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return edits;
+}
+
+void Journal::flush()
+{
+    if (batch.empty()) {
+        return;
+    }
+    bool opened = fd >= 0 || create();
+    if (busy) {
+        Logging::logEntry(path + " is in use by another editor, " + name + " has no journal",
+            Logging::WARN);
+    } else if (!opened || !writeAll(fd, batch)) {
+        Logging::logEntry("Couldn't write the journal " + path + ": " + strerror(errno),
+            Logging::WARN);
+    }
+    batch.clear();
+}
+
+void Journal::mark()
+{
+    flush();
+    marking = true;
+    sinceMark.clear();
+}
+
+void Journal::saved(const string& NAME)
+{
+    marking = false;
+    batch.clear(); // It's all in sinceMark too
+    string edits;
+    edits.swap(sinceMark);
+    string old = path;
+    name = NAME;
+    path = pathFor(NAME);
+    if (busy) {
+        return; // Not this editor's journal, before or after
+    }
+
+    // The old journal is saved, so it goes. One that another editor holds
+    // stays, and this one goes without if it's the one it needs now.
+    bool ours = fd >= 0;
+    busy = (!ours || path != old) && held(path);
+    if (edits.empty() || busy) {
+        if (ours || !held(old)) {
+            unlink(old.c_str());
+        }
+        if (ours) {
+            close(fd);
+            fd = -1;
+        }
+        return;
+    }
+
+    // The edits made during the save are the journal of the saved file. It
+    // replaces the old one locked, so the lock is never let go of.
+    string next = path + ".new";
+    int out = open(next.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (out >= 0 && lock(out) && writeAll(out, header(name) + edits) && rename(next.c_str(), path.c_str()) == 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        fd = out;
+        if (old != path && (ours || !held(old))) {
+            unlink(old.c_str());
+        }
+    } else {
+        Logging::logEntry("Couldn't start the journal " + path + " again: " + strerror(errno),
+            Logging::WARN);
+        if (out >= 0) {
+            close(out);
+        }
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+}
+
+void Journal::unmark()
+{
+    marking = false;
+    sinceMark.clear(); // They are in the journal already
+}
+
+void Journal::remove()
+{
+    batch.clear();
+    sinceMark.clear();
+    if (fd >= 0) {
+        unlink(path.c_str());
+        close(fd);
+        fd = -1;
+    } else if (!busy && !held(path)) {
+        unlink(path.c_str());
+    }
+}
+
+bool Journal::create()
+{
+    // Emptied only once it's locked, a journal another editor holds stays
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return false;
+    }
+    if (!lock(fd)) {
+        close(fd);
+        fd = -1;
+        busy = true;
+        return false;
+    }
+    return ftruncate(fd, 0) == 0 && writeAll(fd, header(name));
+}
+
+void Journal::record(const string& edit)
+{
+    if (busy) {
+        return;
+    }
+    batch += edit;
+    if (marking) {
+        sinceMark += edit;
+    }
+}
+
+void Journal::inserted(size_t y, size_t x, const char* text, size_t n)
+{
+    string edit = "i";
+    putNumber(edit, y);
+    putNumber(edit, x);
+    putText(edit, text, n);
+    record(edit);
+}
+
+void Journal::erased(size_t y, size_t x, size_t n)
+{
+    string edit = "e";
+    putNumber(edit, y);
+    putNumber(edit, x);
+    putNumber(edit, n);
+    record(edit);
+}
+
+void Journal::lineSet(size_t y, const string& text)
+{
+    string edit = "s";
+    putNumber(edit, y);
+    putText(edit, text.data(), text.length());
+    record(edit);
+}
+
+void Journal::linesInserted(size_t y, const vector<string>& texts)
+{
+    string edit = "l";
+    putNumber(edit, y);
+    putNumber(edit, texts.size());
+    for (const string& text : texts) {
+        putText(edit, text.data(), text.length());
+    }
+    record(edit);
+}
+
+void Journal::lineErased(size_t y)
+{
+    string edit = "d";
+    putNumber(edit, y);
+    record(edit);
+}
@@ -0,0 +1,71 @@
+// journal.hpp
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+// Crash recovery for the edits made since the last save
+//
+// Every edit goes into a swap journal next to the file (.name.swp) as a
+// few bytes. The edits are gathered in memory and written in one go by
+// flush(), which the editor calls at most once a second, so typing doesn't
+// cost a system call and a save never has to happen just to be safe. The
+// journal is written but not synced: it outlives the editor or the
+// terminal dying, not the machine. When a file is opened and a journal
+// was left behind for it, its edits are made again (recover()), as long
+// as the file hasn't changed since the journal was started.
+//
+// The editor writing a journal holds a flock() on it, which goes away
+// with the editor. A journal that another editor holds is neither
+// recovered nor written, that editor has the file open and it's still
+// using it: this one goes without a journal.
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "buffer.hpp"
+
+using namespace std;
+
+class Journal : public EditListener {
+public:
+    explicit Journal(const string& NAME); // For file NAME, nothing is written before an edit
+    ~Journal(); // Writes what is pending, the journal stays
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    static string pathFor(const string& name); // Where the journal of a file goes
+
+    // Make the edits of a journal that was left behind again on buffer,
+    // which has just been loaded from the file. Gives how many there were,
+    // or -1 and why if none could be made. It's kept going from there.
+    long recover(TextBuffer& buffer, string& why);
+
+    bool pending() const { return !batch.empty(); } // Edits not written yet
+    void flush(); // Write them
+
+    void mark(); // Saving the buffer as it is now starts
+    void saved(const string& NAME); // That save is done, into file NAME
+    void unmark(); // That save failed, the journal goes on as it was
+    void remove(); // Nothing to recover any more, delete the journal
+
+    // EditListener
+    void inserted(size_t y, size_t x, const char* text, size_t n);
+    void erased(size_t y, size_t x, size_t n);
+    void lineSet(size_t y, const string& text);
+    void linesInserted(size_t y, const vector<string>& texts);
+    void lineErased(size_t y);
+
+private:
+    string name; // The file
+    string path; // The journal
+    int fd = -1; // Open and locked once there's something in it
+    bool busy = false; // Another editor holds the journal, nothing is written
+    string batch; // Edits not written yet
+    bool marking = false; // A save is running
+    string sinceMark; // Edits since it started, they go into the next journal
+
+    void record(const string& edit); // Add an encoded edit
+    bool create(); // Start the journal file with a header (false: busy too)
+    static string header(const string& name); // What the file is like now
+};
+
+#endif // JOURNAL_H
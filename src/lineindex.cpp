@@ -0,0 +1,91 @@
+/*
+*    TextSoup, Yet another text editor
+*    Copyright (C) 2017  Jyry Hjelt
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*/
+// lineindex.cpp
+
+// Include the libraries
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "files.hpp"
+#include "lineindex.hpp"
+
+using namespace std;
+
+LineIndex::LineIndex(shared_ptr<MappedFile> FILE, size_t STRIDE)
+    : file(move(FILE))
+    , stride(STRIDE)
+{
+    worker = thread([this]() { scan(); });
+}
+
+LineIndex::~LineIndex()
+{
+    stopping = true;
+    worker.join();
+}
+
+vector<size_t> LineIndex::offsets(size_t first, size_t last) const
+{
+    lock_guard<mutex> guard(lock);
+    last = min(last, starts.size());
+    if (first >= last) {
+        return vector<size_t>();
+    }
+    return vector<size_t>(starts.begin() + first, starts.begin() + last);
+}
+
+void LineIndex::scan()
+{
+    const size_t BLOCK = 1 << 20; // Bytes between publishing the count
+
+#ifdef SCHED_IDLE
+    // Only run when the editor has nothing to do, so on a machine with few
+    // cores counting doesn't take turns with handling the keys
+    sched_param param = sched_param();
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+
+    const char* data = file->data();
+    size_t end = file->size();
+    size_t at = 0, lines = 0;
+    vector<size_t> found;
+
+    while (at < end && !stopping.load(memory_order_relaxed)) {
+        size_t blockEnd = min(end, at + BLOCK);
+        while (at < blockEnd) {
+            if (lines % stride == 0) {
+                found.push_back(at);
+            }
+            // The last line doesn't need a newline, like in TextBuffer
+            const char* nl = static_cast<const char*>(memchr(data + at, '\n', end - at));
+            at = nl ? size_t(nl - data) + 1 : end;
+            lines++;
+        }
+
+        {
+            lock_guard<mutex> guard(lock);
+            starts.insert(starts.end(), found.begin(), found.end());
+        }
+        found.clear();
+        counted.store(lines, memory_order_release);
+    }
+    finished.store(at >= end, memory_order_release);
+}
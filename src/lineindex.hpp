@@ -0,0 +1,48 @@
+// lineindex.hpp
+#ifndef LINEINDEX_H
+#define LINEINDEX_H
+
+// Counting the lines of a big file in the background
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+class MappedFile; // files.hpp
+
+// Scans a mapped file for newlines on its own thread and keeps the byte
+// offset of every stride'th line. The editor shows the line count as it
+// grows, and TextBuffer uses the offsets to split the lines between two of
+// them out of the mapping on many threads at once (see indexTo()).
+class LineIndex {
+public:
+    LineIndex(shared_ptr<MappedFile> file, size_t stride); // Starts scanning
+    ~LineIndex(); // Stops scanning
+    LineIndex(const LineIndex&) = delete;
+    LineIndex& operator=(const LineIndex&) = delete;
+
+    size_t lines() const { return counted.load(memory_order_acquire); } // So far
+    bool done() const { return finished.load(memory_order_acquire); }
+
+    // Offsets of the lines first * stride, (first + 1) * stride... up to but
+    // not including last * stride, as far as they have been found
+    vector<size_t> offsets(size_t first, size_t last) const;
+
+private:
+    shared_ptr<MappedFile> file;
+    size_t stride;
+
+    mutable mutex lock; // Guards starts
+    vector<size_t> starts; // Offset of every stride'th line
+    atomic<size_t> counted{ 0 };
+    atomic<bool> finished{ false };
+    atomic<bool> stopping{ false };
+    thread worker;
+
+    void scan();
+};
+
+#endif // LINEINDEX_H
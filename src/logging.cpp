@@ -0,0 +1,252 @@
+/*
+*    TextSoup, Yet another text editor
+*    Copyright (C) 2017  Jyry Hjelt
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*/
+// logging.cpp
+
+// Include the libraries
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <fcntl.h>
+#include <mutex>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+#include "logging.hpp"
+
+using namespace std;
+
+namespace {
+
+const size_t RING_SLOTS = 1024; // Must be a power of two
+const size_t ENTRY_TEXT = 496; // Longer entries get cut
+
+// One entry in the ring. seq tells whose turn it is to use the slot.
+struct Slot {
+    atomic<size_t> seq;
+    time_t time;
+    Logging::ErrType type;
+    size_t length;
+    char text[ENTRY_TEXT];
+};
+
+// Bounded multi-producer queue (Dmitry Vyukov's design) and its flusher
+struct Logger {
+    Slot slots[RING_SLOTS];
+    atomic<size_t> head{ 0 }; // Next slot to fill
+    size_t tail = 0; // Next slot to write out (guarded by drainLock)
+    atomic<size_t> dropped{ 0 }; // Entries lost to a full ring
+
+    mutex drainLock; // One thread writes the file at a time
+    int fd = -1;
+    string location = LOG_FILE;
+
+    mutex wakeLock;
+    condition_variable wake;
+    bool stopping = false;
+    thread flusher;
+
+    Logger()
+    {
+        for (size_t i = 0; i < RING_SLOTS; i++) {
+            slots[i].seq.store(i, memory_order_relaxed);
+        }
+    }
+};
+
+void stopLogger();
+
+Logger& logger()
+{
+    // Started on first use, never destroyed so entries logged during exit
+    // still have somewhere to go
+    static Logger* l = []() {
+        Logger* l = new Logger;
+        l->flusher = thread([l]() {
+            unique_lock<mutex> lock(l->wakeLock);
+            while (!l->stopping) {
+                l->wake.wait_for(lock, chrono::milliseconds(100));
+                lock.unlock();
+                Logging::flush();
+                lock.lock();
+            }
+        });
+        atexit(stopLogger);
+        return l;
+    }();
+    return *l;
+}
+
+// Write out what's left and stop the flusher thread
+void stopLogger()
+{
+    Logger& l = logger();
+    {
+        lock_guard<mutex> lock(l.wakeLock);
+        l.stopping = true;
+    }
+    l.wake.notify_one();
+    if (l.flusher.joinable()) {
+        l.flusher.join();
+    }
+    Logging::flush();
+}
+
+int levelFromEnv()
+{
+    const char* level = getenv("TEXTSOUP_LOG_LEVEL");
+    if (!level)
+        return 0;
+    if (!strcasecmp(level, "note"))
+        return Logging::getSeverity(Logging::NOTE);
+    if (!strcasecmp(level, "warning") || !strcasecmp(level, "warn"))
+        return Logging::getSeverity(Logging::WARN);
+    if (!strcasecmp(level, "fatal"))
+        return Logging::getSeverity(Logging::FATAL);
+    return 0;
+}
+
+// Put an entry into the ring, false if the ring is full
+bool push(Logger& l, const string& entry, Logging::ErrType type)
+{
+    size_t pos = l.head.load(memory_order_relaxed);
+    Slot* slot;
+    for (;;) {
+        slot = &l.slots[pos & (RING_SLOTS - 1)];
+        size_t seq = slot->seq.load(memory_order_acquire);
+        intptr_t diff = intptr_t(seq) - intptr_t(pos);
+        if (diff == 0) {
+            if (l.head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            return false; // Full
+        } else {
+            pos = l.head.load(memory_order_relaxed);
+        }
+    }
+
+    slot->time = time(NULL);
+    slot->type = type;
+    slot->length = min(entry.length(), ENTRY_TEXT);
+    memcpy(slot->text, entry.data(), slot->length);
+    slot->seq.store(pos + 1, memory_order_release);
+    return true;
+}
+
+// Append text to the log file, which is opened once and kept open. The
+// caller holds drainLock.
+void writeOut(Logger& l, const char* data, size_t left)
+{
+    if (left == 0) {
+        return;
+    }
+    if (l.fd < 0) {
+        l.fd = open(l.location.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+    }
+    while (l.fd >= 0 && left > 0) {
+        ssize_t n = write(l.fd, data, left);
+        if (n <= 0)
+            break;
+        data += n;
+        left -= n;
+    }
+}
+
+// Format a log line the way it has always looked
+void format(string& out, time_t t, Logging::ErrType type, const char* text, size_t length)
+{
+    tm time_now;
+    localtime_r(&t, &time_now);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%D %H:%M:%S ", &time_now);
+
+    out += stamp;
+    out += "[" + Logging::getErrorStr(type) + "] ";
+    out.append(text, length);
+    out += '\n';
+}
+} // namespace
+
+namespace Logging {
+
+atomic<int> minSeverity(levelFromEnv());
+
+void setMinLevel(Logging::ErrType type)
+{
+    minSeverity = getSeverity(type);
+}
+
+void setLogFile(const string& location)
+{
+    Logger& l = logger();
+    lock_guard<mutex> lock(l.drainLock);
+    l.location = location;
+}
+
+void logEntry(const string& entry, Logging::ErrType type)
+{
+    if (!enabled(type)) {
+        return;
+    }
+
+    Logger& l = logger();
+    if (!push(l, entry, type)) {
+        l.dropped.fetch_add(1, memory_order_relaxed);
+    }
+
+    // Don't lose the reason the program died
+    if (type == FATAL) {
+        flush();
+    }
+}
+
+void flush()
+{
+    Logger& l = logger();
+    lock_guard<mutex> lock(l.drainLock);
+
+    // Take everything that's ready out of the ring
+    string out;
+    for (;;) {
+        Slot& slot = l.slots[l.tail & (RING_SLOTS - 1)];
+        if (slot.seq.load(memory_order_acquire) != l.tail + 1)
+            break;
+        format(out, slot.time, slot.type, slot.text, slot.length);
+        slot.seq.store(l.tail + RING_SLOTS, memory_order_release);
+        l.tail++;
+    }
+
+    size_t dropped = l.dropped.exchange(0, memory_order_relaxed);
+    if (dropped > 0) {
+        string msg = to_string(dropped) + " log entries were dropped";
+        format(out, time(NULL), WARN, msg.data(), msg.length());
+    }
+
+    writeOut(l, out.data(), out.length());
+}
+
+void logEndSession()
+{
+    Logger& l = logger();
+    static const char marker[] = "----------END OF SESSION----------\n";
+
+    stopLogger();
+    lock_guard<mutex> lock(l.drainLock);
+    writeOut(l, marker, sizeof(marker) - 1);
+}
+} // Logging
@@ -3,9 +3,11 @@
 #define LOGGING_H
 
 // Logging header for the textSoup text editor
-#include <ctime>
-#include <fstream>
-#include <iomanip>
+//
+// Entries go into a lock-free ring buffer in memory and a background thread
+// writes them into the log file, which it keeps open. Logging never waits on
+// the disk: when the ring is full new entries are dropped and counted.
+#include <atomic>
 #include <string>
 
 using namespace std;
@@ -37,36 +39,45 @@ inline string getErrorStr(Logging::ErrType type)
     return "INTERNAL_ERROR!";
 }
 
-// Make a log entry to the specified file (or the default...)
-inline void logEntry(string entry, Logging::ErrType type, string location = LOG_FILE)
+// How severe an ErrType is (INFO is the least severe)
+inline int getSeverity(Logging::ErrType type)
 {
-    ofstream outfile;
-    // Get the correct time
-    time_t t = time(NULL);
-    tm time_now = *localtime(&t);
-    // Get the string format of the error type
-    string type_str = "[" + getErrorStr(type) + "] ";
-
-    // Open the file for appending
-    outfile.open(location, ios_base::app | ios_base::out);
+    switch (type) {
+    case INFO:
+        return 0;
+    case NOTE:
+        return 1;
+    case WARN:
+        return 2;
+    case FATAL:
+        return 3;
+    }
+    return 3;
+}
 
-    // Put the log entry together
-    outfile << put_time(&time_now, "%D %H:%M:%S ") << type_str << entry << endl;
+// Entries less severe than this are thrown away right away. The starting
+// level can be set with TEXTSOUP_LOG_LEVEL (info, note, warning or fatal).
+extern atomic<int> minSeverity;
+void setMinLevel(Logging::ErrType type);
 
-    // Close the file
-    outfile.close();
+// Would an entry of this type be logged? Check it before building an
+// expensive message
+inline bool enabled(Logging::ErrType type)
+{
+    return getSeverity(type) >= minSeverity.load(memory_order_relaxed);
 }
 
-// Print a 'end of session' statement to clearly distinguish sessions
-inline void logEndSession(string location = LOG_FILE)
-{
-    ofstream outfile;
+// Make a log entry. FATAL entries are written out before returning.
+void logEntry(const string& entry, Logging::ErrType type);
 
-    outfile.open(location, ios_base::app | ios_base::out);
+// Use another log file (before the first entry is written)
+void setLogFile(const string& location);
 
-    outfile << "----------END OF SESSION----------" << endl;
+// Write out everything in the ring buffer now
+void flush();
 
-    outfile.close();
-}
+// Print a 'end of session' statement to clearly distinguish sessions, write
+// out everything that is left and stop the background thread
+void logEndSession();
 } // Logging
 #endif // LOGGING_H
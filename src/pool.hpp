@@ -0,0 +1,38 @@
+// pool.hpp
+#ifndef POOL_H
+#define POOL_H
+
+// A pool of worker threads for splitting big jobs into pieces
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads = 0); // 0 means one per core
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(function<void()> task); // Run a task on some worker
+    size_t size() const { return workers.size(); }
+
+private:
+    vector<thread> workers;
+    deque<function<void()>> tasks;
+    mutex lock;
+    condition_variable wake;
+    bool stopping = false;
+
+    void work();
+};
+
+// The pool shared by the whole editor, started on first use
+ThreadPool& sharedPool();
+
+#endif // POOL_H
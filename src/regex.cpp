@@ -0,0 +1,765 @@
+/*
+*    TextSoup, Yet another text editor
+*    Copyright (C) 2017  Jyry Hjelt
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*/
+// regex.cpp
+
+// Include the libraries
+#include <algorithm>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "regex.hpp"
+
+using namespace std;
+
+namespace {
+
+const size_t MAX_PROGRAM = 20000; // NFA states a pattern may compile into
+const int MAX_REPEAT = 1000; // Biggest count allowed in {m,n}
+const int MAX_DEPTH = 200; // Deepest nesting of groups
+const size_t CACHE_SIZE = 16; // Compiled patterns kept around
+
+// A node of the parsed pattern
+struct Node {
+    enum Type { SET, // One byte out of a class
+        CAT,
+        ALT,
+        REPEAT, // kids[0] min to max times (max -1 for no limit)
+        BEGIN, // ^
+        END, // $
+        EMPTY } type;
+    int cls = -1;
+    int min = 0, max = 0;
+    vector<int> kids;
+};
+
+// Recursive descent parser from a pattern into nodes
+class Parser {
+public:
+    Parser(const string& pattern, vector<vector<bool>>& classes)
+        : p(pattern)
+        , classes(classes)
+    {
+    }
+
+    vector<Node> nodes;
+    string error;
+
+    int parse()
+    {
+        int n = alt();
+        if (error.empty() && pos < p.length()) {
+            error = "unmatched )";
+        }
+        return error.empty() ? n : -1;
+    }
+
+private:
+    const string& p;
+    vector<vector<bool>>& classes;
+    size_t pos = 0;
+    int depth = 0;
+
+    int add(Node::Type type)
+    {
+        nodes.push_back(Node());
+        nodes.back().type = type;
+        return int(nodes.size()) - 1;
+    }
+
+    int addSet(const vector<bool>& set)
+    {
+        classes.push_back(set);
+        int n = add(Node::SET);
+        nodes[n].cls = int(classes.size()) - 1;
+        return n;
+    }
+
+    bool more() const { return pos < p.length() && error.empty(); }
+
+    // a|b|c
+    int alt()
+    {
+        int first = concat();
+        if (!more() || p[pos] != '|')
+            return first;
+
+        int n = add(Node::ALT);
+        nodes[n].kids.push_back(first);
+        while (more() && p[pos] == '|') {
+            pos++;
+            int kid = concat();
+            nodes[n].kids.push_back(kid);
+        }
+        return n;
+    }
+
+    // abc
+    int concat()
+    {
+        int n = add(Node::CAT);
+        while (more() && p[pos] != '|' && p[pos] != ')') {
+            int kid = repeat();
+            nodes[n].kids.push_back(kid);
+        }
+        if (nodes[n].kids.empty())
+            nodes[n].type = Node::EMPTY;
+        return n;
+    }
+
+    // a* a+ a? a{m,n}
+    int repeat()
+    {
+        int n = atom();
+        while (more()) {
+            int min, max;
+            char c = p[pos];
+            if (c == '*') {
+                min = 0, max = -1;
+            } else if (c == '+') {
+                min = 1, max = -1;
+            } else if (c == '?') {
+                min = 0, max = 1;
+            } else if (c == '{') {
+                if (!count(min, max))
+                    break; // Not a count, a literal '{'
+            } else {
+                break;
+            }
+            if (c != '{')
+                pos++;
+            if (nodes[n].type == Node::BEGIN || nodes[n].type == Node::END) {
+                error = "nothing to repeat";
+                return n;
+            }
+
+            int r = add(Node::REPEAT);
+            nodes[r].min = min;
+            nodes[r].max = max;
+            nodes[r].kids.push_back(n);
+            n = r;
+        }
+        return n;
+    }
+
+    // {m} {m,} {m,n}, false (without moving) if what follows isn't one
+    bool count(int& min, int& max)
+    {
+        size_t i = pos + 1;
+        if (!number(i, min))
+            return false;
+        max = min;
+        if (i < p.length() && p[i] == ',') {
+            i++;
+            if (!number(i, max))
+                max = -1;
+        }
+        if (i >= p.length() || p[i] != '}')
+            return false;
+
+        pos = i + 1;
+        if (min > MAX_REPEAT || max > MAX_REPEAT) {
+            error = "count over " + to_string(MAX_REPEAT);
+        } else if (max != -1 && max < min) {
+            error = "bad count";
+        }
+        return true;
+    }
+
+    bool number(size_t& i, int& value)
+    {
+        size_t start = i;
+        value = 0;
+        // All the digits are read, a count that's too big is an error
+        for (; i < p.length() && p[i] >= '0' && p[i] <= '9'; i++) {
+            value = min(value * 10 + (p[i] - '0'), MAX_REPEAT + 1);
+        }
+        return i > start;
+    }
+
+    int atom()
+    {
+        char c = p[pos++];
+        switch (c) {
+        case '(': {
+            if (++depth > MAX_DEPTH) {
+                error = "too deeply nested";
+                return add(Node::EMPTY);
+            }
+            int n = alt();
+            depth--;
+            if (error.empty() && (pos >= p.length() || p[pos] != ')')) {
+                error = "missing )";
+            }
+            pos++;
+            return n;
+        }
+        case '[':
+            return bracket();
+        case '.':
+            return addSet(vector<bool>(256, true));
+        case '^':
+            return add(Node::BEGIN);
+        case '$':
+            return add(Node::END);
+        case '*':
+        case '+':
+        case '?':
+            error = "nothing to repeat";
+            return add(Node::EMPTY);
+        case '\\': {
+            vector<bool> set(256, false);
+            escape(set);
+            return addSet(set);
+        }
+        default: {
+            vector<bool> set(256, false);
+            set[(unsigned char)c] = true;
+            return addSet(set);
+        }
+        }
+    }
+
+    // After a backslash: add what it stands for to set
+    void escape(vector<bool>& set)
+    {
+        if (pos >= p.length()) {
+            error = "trailing \\";
+            return;
+        }
+        char c = p[pos++];
+        vector<bool> s(256, false);
+        bool negate = c == 'D' || c == 'W' || c == 'S';
+        switch (c) {
+        case 'd':
+        case 'D':
+            for (int i = '0'; i <= '9'; i++)
+                s[i] = true;
+            break;
+        case 'w':
+        case 'W':
+            for (int i = 0; i < 256; i++)
+                s[i] = (i >= '0' && i <= '9') || (i >= 'A' && i <= 'Z') || (i >= 'a' && i <= 'z') || i == '_';
+            break;
+        case 's':
+        case 'S':
+            for (char w : string(" \t\n\r\f\v"))
+                s[(unsigned char)w] = true;
+            break;
+        case 't':
+            s['\t'] = true;
+            break;
+        case 'n':
+            s['\n'] = true;
+            break;
+        case 'r':
+            s['\r'] = true;
+            break;
+        case 'f':
+            s['\f'] = true;
+            break;
+        case 'v':
+            s['\v'] = true;
+            break;
+        default:
+            if ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z')) {
+                error = string("unknown escape \\") + c;
+                return;
+            }
+            s[(unsigned char)c] = true;
+        }
+        for (int i = 0; i < 256; i++) {
+            if (s[i] != negate)
+                set[i] = true;
+        }
+    }
+
+    // [abc] [^a-z] [\d_]
+    int bracket()
+    {
+        vector<bool> set(256, false);
+        bool negate = false;
+        if (pos < p.length() && p[pos] == '^') {
+            negate = true;
+            pos++;
+        }
+
+        bool first = true;
+        while (error.empty()) {
+            if (pos >= p.length()) {
+                error = "missing ]";
+                break;
+            }
+            char c = p[pos];
+            if (c == ']' && !first) {
+                pos++;
+                break;
+            }
+            first = false;
+
+            if (c == '\\') {
+                pos++;
+                // A lone escaped byte can start a range, a class can't
+                vector<bool> s(256, false);
+                escape(s);
+                if (count_if(s.begin(), s.end(), [](bool b) { return b; }) != 1
+                    || pos + 1 >= p.length() || p[pos] != '-' || p[pos + 1] == ']') {
+                    for (int i = 0; i < 256; i++)
+                        set[i] = set[i] || s[i];
+                    continue;
+                }
+                c = char(find(s.begin(), s.end(), true) - s.begin());
+                pos--; // Pretend c was the byte just read
+            }
+            pos++;
+
+            // A range a-z
+            unsigned char low = c, high = c;
+            if (pos + 1 < p.length() && p[pos] == '-' && p[pos + 1] != ']') {
+                pos++;
+                char h = p[pos++];
+                if (h == '\\') {
+                    vector<bool> s(256, false);
+                    escape(s);
+                    h = char(find(s.begin(), s.end(), true) - s.begin());
+                }
+                high = h;
+                if (high < low) {
+                    error = "bad range";
+                    break;
+                }
+            }
+            for (int i = low; i <= high; i++)
+                set[i] = true;
+        }
+
+        if (negate)
+            set.flip();
+        return addSet(set);
+    }
+};
+
+bool canBeEmpty(const vector<Node>& nodes, int n)
+{
+    const Node& node = nodes[n];
+    switch (node.type) {
+    case Node::SET:
+        return false;
+    case Node::CAT:
+        for (int kid : node.kids) {
+            if (!canBeEmpty(nodes, kid))
+                return false;
+        }
+        return true;
+    case Node::ALT:
+        for (int kid : node.kids) {
+            if (canBeEmpty(nodes, kid))
+                return true;
+        }
+        return false;
+    case Node::REPEAT:
+        return node.min == 0 || canBeEmpty(nodes, node.kids[0]);
+    default:
+        return true;
+    }
+}
+
+// Thompson's construction, written backwards: every node is compiled with
+// the state that follows it already known. Reversed programs match the
+// pattern's text back to front, which is how match starts are found.
+class Compiler {
+public:
+    Compiler(const vector<Node>& nodes, Regex::Program& prog, bool reversed)
+        : nodes(nodes)
+        , prog(prog)
+        , reversed(reversed)
+    {
+    }
+
+    bool build(int root)
+    {
+        prog.states.clear();
+        prog.match = add(Regex::State::MATCH, -1, -1);
+        prog.start = compile(root, prog.match);
+        return prog.states.size() <= MAX_PROGRAM;
+    }
+
+private:
+    const vector<Node>& nodes;
+    Regex::Program& prog;
+    bool reversed;
+
+    int add(Regex::State::Kind kind, int out, int out1, int cls = -1)
+    {
+        if (prog.states.size() > MAX_PROGRAM)
+            return 0; // Too big, build() gives up
+        prog.states.push_back(Regex::State{ kind, cls, out, out1 });
+        return int(prog.states.size()) - 1;
+    }
+
+    int compile(int n, int next)
+    {
+        const Node& node = nodes[n];
+        switch (node.type) {
+        case Node::SET:
+            return add(Regex::State::CHAR, next, -1, node.cls);
+        case Node::CAT:
+            if (reversed) {
+                for (int kid : node.kids)
+                    next = compile(kid, next);
+            } else {
+                for (size_t i = node.kids.size(); i-- > 0;)
+                    next = compile(node.kids[i], next);
+            }
+            return next;
+        case Node::ALT: {
+            int out = compile(node.kids.back(), next);
+            for (size_t i = node.kids.size() - 1; i-- > 0;) {
+                int kid = compile(node.kids[i], next);
+                out = add(Regex::State::SPLIT, kid, out);
+            }
+            return out;
+        }
+        case Node::REPEAT:
+            return repeat(node, next);
+        case Node::BEGIN:
+            return add(reversed ? Regex::State::AT_END : Regex::State::AT_START, next, -1);
+        case Node::END:
+            return add(reversed ? Regex::State::AT_START : Regex::State::AT_END, next, -1);
+        case Node::EMPTY:
+            return next;
+        }
+        return next;
+    }
+
+    int repeat(const Node& node, int next)
+    {
+        int kid = node.kids[0];
+        if (node.max == -1) {
+            // kid* loops through a split, kid+ is kid followed by kid*
+            int loop = add(Regex::State::SPLIT, -1, next);
+            int body = compile(kid, loop);
+            if (prog.states.size() > MAX_PROGRAM)
+                return next;
+            prog.states[loop].out = body;
+            if (node.min == 0)
+                return loop;
+            next = body;
+            for (int i = 1; i < node.min && prog.states.size() <= MAX_PROGRAM; i++)
+                next = compile(kid, next);
+            return next;
+        }
+
+        // Optional copies nest: a{0,2} is (a(a)?)?
+        int tail = next;
+        for (int i = node.min; i < node.max && prog.states.size() <= MAX_PROGRAM; i++) {
+            tail = add(Regex::State::SPLIT, compile(kid, tail), next);
+        }
+        for (int i = 0; i < node.min && prog.states.size() <= MAX_PROGRAM; i++) {
+            tail = compile(kid, tail);
+        }
+        return tail;
+    }
+};
+
+// Recently compiled patterns, the most recent first
+mutex cacheLock;
+list<pair<string, shared_ptr<const Regex>>> cache;
+} // namespace
+
+// A DFA built one transition at a time while matching. Every DFA state is a
+// set of NFA states, a transition is computed the first time it's taken and
+// then it's a single table lookup.
+struct Regex::Dfa {
+    static const size_t MAX_STATES = 2048; // Start over when there are more
+
+    struct DState {
+        vector<int> set; // NFA states
+        bool accept; // A match ends here
+        bool acceptAtEnd; // A match ends here if the scan ends here
+        int next[256];
+    };
+
+    const Program& prog;
+    const vector<vector<bool>>& classes;
+    bool unanchored; // A match may begin after any byte, not just the first
+    vector<DState> states;
+    map<vector<int>, int> ids;
+    int starts[2] = { -1, -1 }; // Start state inside / at the start of the scan
+    size_t resets = 0; // Times the states were dropped, their numbers change
+    vector<char> seen; // Scratch space for closure()
+
+    Dfa(const Program& prog, const vector<vector<bool>>& classes, bool unanchored)
+        : prog(prog)
+        , classes(classes)
+        , unanchored(unanchored)
+        , seen(prog.states.size(), 0)
+    {
+    }
+
+    // The start state, atStart when nothing has been scanned yet
+    int start(bool atStart)
+    {
+        int& s = starts[atStart];
+        if (s < 0) {
+            vector<int> seeds(1, prog.start);
+            s = intern(closure(seeds, atStart, false));
+        }
+        return s;
+    }
+
+    // The state after c from s (the slow path of a lookup in next)
+    int step(int s, unsigned char c)
+    {
+        vector<int> seeds;
+        for (int n : states[s].set) {
+            const State& st = prog.states[n];
+            if (st.kind == State::CHAR && classes[st.cls][c])
+                seeds.push_back(st.out);
+        }
+        if (unanchored)
+            seeds.push_back(prog.start);
+        vector<int> set = closure(seeds, false, false);
+
+        if (states.size() >= MAX_STATES) {
+            // Too many states for the pattern: drop them all and keep going
+            vector<int> from = states[s].set;
+            states.clear();
+            ids.clear();
+            starts[0] = starts[1] = -1;
+            resets++;
+            s = intern(from);
+        }
+        int t = intern(set);
+        states[s].next[c] = t;
+        return t;
+    }
+
+    bool dead(int s) const { return states[s].set.empty(); }
+
+    // Follow the empty moves from seeds. Assertions are crossed only where
+    // they hold, the ones that don't are kept in the set.
+    vector<int> closure(vector<int>& stack, bool atStart, bool atEnd)
+    {
+        vector<int> set;
+        while (!stack.empty()) {
+            int n = stack.back();
+            stack.pop_back();
+            if (n < 0 || seen[n])
+                continue;
+            seen[n] = 1;
+            set.push_back(n);
+
+            const State& st = prog.states[n];
+            if (st.kind == State::SPLIT) {
+                stack.push_back(st.out1);
+                stack.push_back(st.out);
+            } else if ((st.kind == State::AT_START && atStart) || (st.kind == State::AT_END && atEnd)) {
+                stack.push_back(st.out);
+            }
+        }
+        for (int n : set)
+            seen[n] = 0;
+
+        // Only the states that do something tell DFA states apart
+        set.erase(remove_if(set.begin(), set.end(), [&](int n) {
+            return prog.states[n].kind == State::SPLIT;
+        }),
+            set.end());
+        sort(set.begin(), set.end());
+        return set;
+    }
+
+    int intern(const vector<int>& set)
+    {
+        map<vector<int>, int>::iterator it = ids.find(set);
+        if (it != ids.end())
+            return it->second;
+
+        states.push_back(DState());
+        DState& d = states.back();
+        d.set = set;
+        d.accept = binary_search(set.begin(), set.end(), prog.match);
+        vector<int> seeds = set;
+        vector<int> end = closure(seeds, false, true);
+        d.acceptAtEnd = binary_search(end.begin(), end.end(), prog.match);
+        fill(d.next, d.next + 256, -1);
+
+        int id = int(states.size()) - 1;
+        ids[set] = id;
+        return id;
+    }
+};
+
+Regex::~Regex()
+{
+}
+
+shared_ptr<const Regex> Regex::compile(const string& pattern, string& error)
+{
+    {
+        lock_guard<mutex> lock(cacheLock);
+        for (auto it = cache.begin(); it != cache.end(); ++it) {
+            if (it->first == pattern) {
+                cache.splice(cache.begin(), cache, it);
+                return it->second;
+            }
+        }
+    }
+
+    shared_ptr<Regex> re = make_shared<Regex>();
+    re->pattern = pattern;
+    Parser parser(pattern, re->classes);
+    int root = parser.parse();
+    if (root < 0) {
+        error = parser.error;
+        return nullptr;
+    }
+    re->nullable = canBeEmpty(parser.nodes, root);
+    if (!Compiler(parser.nodes, re->forwardProgram, false).build(root)
+        || !Compiler(parser.nodes, re->reverseProgram, true).build(root)) {
+        error = "pattern too big";
+        return nullptr;
+    }
+
+    lock_guard<mutex> lock(cacheLock);
+    cache.push_front(make_pair(pattern, re));
+    if (cache.size() > CACHE_SIZE)
+        cache.pop_back();
+    return re;
+}
+
+Regex::Matcher Regex::matcher() const
+{
+    lock_guard<mutex> lock(dfaLock);
+    pair<unique_ptr<Dfa>, unique_ptr<Dfa>>& d = dfas[this_thread::get_id()];
+    if (!d.first) {
+        d.first.reset(new Dfa(reverseProgram, classes, true));
+        d.second.reset(new Dfa(forwardProgram, classes, false));
+    }
+
+    Matcher m;
+    m.startDfa = d.first.get();
+    m.endDfa = d.second.get();
+    m.nullable = nullable;
+    return m;
+}
+
+void Regex::Matcher::findStarts(LineView line, vector<size_t>& starts, bool every)
+{
+    // Scan the line backwards with the reversed pattern. Every byte may be
+    // the last one of a match, and the DFA accepts right after reading the
+    // first byte of one.
+    Dfa& dfa = *startDfa;
+    size_t first = starts.size();
+    int s = dfa.start(true);
+    if (line.size == 0 ? dfa.states[s].acceptAtEnd : dfa.states[s].accept)
+        starts.push_back(line.size);
+
+    const unsigned char* text = reinterpret_cast<const unsigned char*>(line.data);
+    for (size_t i = line.size; i-- > 0;) {
+        int t = dfa.states[s].next[text[i]];
+        s = t >= 0 ? t : dfa.step(s, text[i]);
+        if (dfa.states[s].accept || (i == 0 && dfa.states[s].acceptAtEnd))
+            starts.push_back(i);
+    }
+    reverse(starts.begin() + first, starts.end());
+
+    // A pattern that matches nothing would hit every column, only the
+    // first one of the line is worth showing
+    if (nullable && !every && starts.size() > first + 1)
+        starts.resize(first + 1);
+}
+
+size_t Regex::Matcher::matchLength(LineView line, size_t x)
+{
+    Dfa& dfa = *endDfa;
+    int s = dfa.start(x == 0);
+    size_t longest = string::npos;
+    if (dfa.states[s].accept || (x == line.size && dfa.states[s].acceptAtEnd))
+        longest = 0;
+
+    const unsigned char* text = reinterpret_cast<const unsigned char*>(line.data);
+    for (size_t i = x; i < line.size && !dfa.dead(s); i++) {
+        int t = dfa.states[s].next[text[i]];
+        s = t >= 0 ? t : dfa.step(s, text[i]);
+        if (dfa.states[s].accept || (i + 1 == line.size && dfa.states[s].acceptAtEnd))
+            longest = i + 1 - x;
+    }
+    return longest;
+}
+
+void Regex::Matcher::replaced(LineView line, const vector<size_t>& starts, vector<pair<size_t, size_t>>& matches)
+{
+    matches.clear();
+    if (starts.empty()) {
+        return;
+    }
+    Dfa& dfa = *endDfa;
+    const unsigned char* text = reinterpret_cast<const unsigned char*>(line.data);
+    scanState.assign(line.size + 1, -1);
+    scanEnd.resize(line.size + 1);
+    size_t resets = dfa.resets;
+
+    size_t done = 0; // End of the last match
+    for (size_t x : starts) {
+        if (x < done) {
+            continue; // Overlaps the last match
+        }
+
+        // Scan to where the DFA dies, the line ends or an earlier scan was in
+        // the same state. scanEnd gets whether a match ends at each column.
+        int s = dfa.start(x == 0);
+        size_t i = x;
+        size_t furthest = string::npos; // Past where this scan stopped
+        while (true) {
+            if (dfa.resets != resets) {
+                // The states were numbered again, the old numbers mean nothing
+                fill(scanState.begin(), scanState.end(), -1);
+                resets = dfa.resets;
+            }
+            if (scanState[i] == s) {
+                furthest = scanEnd[i];
+                break;
+            }
+            scanState[i] = s;
+            bool accept = dfa.states[s].accept || (i == line.size && dfa.states[s].acceptAtEnd);
+            scanEnd[i] = accept ? i : string::npos;
+            if (i == line.size || dfa.dead(s)) {
+                i++;
+                break;
+            }
+            int t = dfa.states[s].next[text[i]];
+            s = t >= 0 ? t : dfa.step(s, text[i]);
+            i++;
+        }
+        // Then the furthest end from every column of it on, backwards
+        for (size_t c = i; c-- > x;) {
+            if (furthest == string::npos)
+                furthest = scanEnd[c];
+            scanEnd[c] = furthest;
+        }
+
+        if (scanEnd[x] == string::npos || scanEnd[x] == x) {
+            continue;
+        }
+        matches.push_back(make_pair(x, scanEnd[x] - x));
+        done = scanEnd[x];
+    }
+}
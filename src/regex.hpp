@@ -0,0 +1,90 @@
+// regex.hpp
+#ifndef REGEX_H
+#define REGEX_H
+
+// Regular expressions for searching, matched with a lazily built DFA
+//
+// Supported: literals, '.', [classes] with ranges and '^', \d \w \s (and
+// \D \W \S), escapes, groups, '|', '*', '+', '?', {m}, {m,} and {m,n}, and
+// the anchors '^' and '$'. There is no backtracking: a line is matched in
+// one pass over its bytes whatever the pattern looks like.
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "buffer.hpp"
+
+using namespace std;
+
+class Regex {
+public:
+    // Compile a pattern, or get it from the cache of recent patterns. Gives
+    // nullptr and sets error if the pattern is broken.
+    static shared_ptr<const Regex> compile(const string& pattern, string& error);
+
+    bool matchesEmpty() const { return nullable; } // Does "" match?
+
+    struct Dfa;
+
+    // Runs the pattern over lines. The DFA states it builds stay in the
+    // Regex for the next matcher on the same thread, a matcher itself must
+    // only be used by one thread.
+    class Matcher {
+    public:
+        // Put every column of line where a match starts into starts. A
+        // pattern that matches nothing starts everywhere, only the first
+        // column is kept unless every is set (replacing needs them all).
+        void findStarts(LineView line, vector<size_t>& starts, bool every = false);
+        // Length of the longest match starting at column x (npos for none)
+        size_t matchLength(LineView line, size_t x);
+        // The matches replacing takes as (column, length): the longest at a
+        // start, from the left, not overlapping and not empty. starts are
+        // what findStarts() gave with every set. A scan that gets into the
+        // state an earlier one was in at the same column ends like it did,
+        // so it stops there: a line takes about one scan, not one per start.
+        void replaced(LineView line, const vector<size_t>& starts, vector<pair<size_t, size_t>>& matches);
+
+    private:
+        friend class Regex;
+        Dfa* startDfa; // Finds the starts scanning backwards
+        Dfa* endDfa; // Finds the ends scanning forwards from a start
+        bool nullable;
+        vector<int> scanState; // State a scan was in at every column (replaced())
+        vector<size_t> scanEnd; // Furthest match end of that scan from there on
+    };
+    Matcher matcher() const;
+
+    // The compiled program (Thompson NFA)
+    struct State {
+        enum Kind { CHAR,
+            SPLIT,
+            AT_START, // Only before the first byte of the scan
+            AT_END, // Only after the last byte of the scan
+            MATCH } kind;
+        int cls; // Character class for CHAR
+        int out, out1; // Next states (-1 for none)
+    };
+    struct Program {
+        vector<State> states;
+        int start;
+        int match;
+    };
+
+private:
+    string pattern;
+    bool nullable = false;
+    vector<vector<bool>> classes; // 256 entries per class
+    Program forwardProgram, reverseProgram;
+
+    // Lazy DFAs per thread
+    mutable mutex dfaLock;
+    mutable map<thread::id, pair<unique_ptr<Dfa>, unique_ptr<Dfa>>> dfas;
+
+public:
+    ~Regex();
+};
+
+#endif // REGEX_H
@@ -0,0 +1,81 @@
+/*
+*    TextSoup, Yet another text editor
+*    Copyright (C) 2017  Jyry Hjelt
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*/
+// render.cpp
+
+// Include the libraries
+#include <string>
+#include <vector>
+
+#include "buffer.hpp"
+#include "render.hpp"
+#include "terminal.hpp"
+#include "utf8.hpp"
+
+using namespace std;
+
+void Renderer::begin(unsigned int rows, unsigned int width)
+{
+    // A resized terminal has to be drawn from scratch
+    if (rows != shown.size() || width != cols) {
+        full = true;
+    }
+    cols = width;
+    next.assign(rows, ScreenRow());
+}
+
+void Renderer::setRow(unsigned int y, ScreenRow row)
+{
+    if (y >= next.size()) {
+        return;
+    }
+    // Cut to the width of the screen in columns, a character at a time. A
+    // row with fewer bytes than columns fits anyway.
+    if (row.text.length() > cols) {
+        LineView view{ row.text.data(), row.text.length(), 0, Utf8::isAscii(row.text.data(), row.text.length()), true };
+        view.width = view.ascii ? uint32_t(view.size) : Utf8::measure(view.data, view.size, view.valid);
+        if (view.width > cols || !view.valid) {
+            string cut;
+            Utf8::clip(view, cols, cut);
+            row.text.swap(cut);
+        }
+    }
+    if (row.colours.size() > row.text.length()) {
+        row.colours.resize(row.text.length());
+    }
+    next[y] = move(row);
+}
+
+void Renderer::present(Terminal& terminal)
+{
+    if (full) {
+        terminal.clearScreen();
+    }
+
+    // Only touch the rows that differ from the last frame
+    for (unsigned int y = 0; y < next.size(); y++) {
+        if (full || y >= shown.size() || next[y] != shown[y]) {
+            terminal.drawRow(y, cols, next[y]);
+        }
+    }
+
+    shown.swap(next);
+    full = false;
+    terminal.show();
+}
+
+void Renderer::invalidate()
+{
+    full = true;
+}
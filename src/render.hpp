@@ -0,0 +1,46 @@
+// render.hpp
+#ifndef RENDER_H
+#define RENDER_H
+
+// Damage tracked screen drawing for the textSoup text editor
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class Terminal; // terminal.hpp
+
+// What a single row of the screen should look like
+struct ScreenRow {
+    string text; // The characters of the row (clipped to the screen)
+    int cursor = -1; // Byte of the character drawn with the cursor colours (-1 for none)
+    bool inverted = false; // Draw the whole text with the cursor colours
+    bool rule = false; // Draw a horizontal line instead of text
+    vector<uint8_t> colours; // Highlight::Colour of each byte of text (none: all plain)
+
+    bool operator==(const ScreenRow& o) const
+    {
+        return cursor == o.cursor && inverted == o.inverted && rule == o.rule && text == o.text
+            && colours == o.colours;
+    }
+    bool operator!=(const ScreenRow& o) const { return !(*this == o); }
+};
+
+// Keeps the rows drawn in the last frame and only sends the rows that
+// changed to the terminal, so a keystroke costs the same on any file
+class Renderer {
+public:
+    void begin(unsigned int rows, unsigned int cols); // Start a new frame
+    void setRow(unsigned int y, ScreenRow row); // Describe a row of the frame
+    void present(Terminal& terminal); // Draw the damaged rows and show them
+    void invalidate(); // Draw every row in the next frame
+
+private:
+    vector<ScreenRow> shown; // Rows on the terminal right now
+    vector<ScreenRow> next; // Rows of the frame being built
+    unsigned int cols = 0;
+    bool full = true; // Redraw everything in the next present()
+};
+
+#endif // RENDER_H
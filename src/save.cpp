@@ -0,0 +1,58 @@
+/*
+*    TextSoup, Yet another text editor
+*    Copyright (C) 2017  Jyry Hjelt
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*/
+// save.cpp
+
+// Include the libraries
+#include <string>
+#include <thread>
+
+#include "save.hpp"
+
+using namespace std;
+
+BackgroundSave::~BackgroundSave()
+{
+    // Never leave a half written file behind
+    if (running()) {
+        wait();
+    }
+}
+
+bool BackgroundSave::start(const string& NAME, const TextBuffer& buffer)
+{
+    if (running()) {
+        return false;
+    }
+
+    name = NAME;
+    snapshot = buffer; // O(1), the nodes are shared
+    done = false;
+    written = 0;
+    worker = thread([this]() {
+        stats = writeToFile(name, snapshot, &written);
+        done = true;
+    });
+    return true;
+}
+
+SaveStats BackgroundSave::wait(TextBuffer* saved)
+{
+    worker.join();
+    if (saved && stats.ok) {
+        saved->markSaved(snapshot);
+    }
+    snapshot = TextBuffer(); // Let go of the shared nodes
+    return stats;
+}
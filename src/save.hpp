@@ -0,0 +1,41 @@
+// save.hpp
+#ifndef SAVE_H
+#define SAVE_H
+
+// Saving files on a worker thread
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "buffer.hpp"
+#include "files.hpp"
+
+using namespace std;
+
+// Writes a snapshot of a buffer to a file on its own thread. The snapshot
+// shares the buffer's nodes (see TextBuffer), so edits made while the save
+// runs go to new nodes and never reach the file being written.
+class BackgroundSave {
+public:
+    ~BackgroundSave();
+
+    bool start(const string& NAME, const TextBuffer& buffer); // false if busy
+    bool running() const { return worker.joinable(); }
+    bool finished() const { return done.load(); } // The worker is done
+    size_t progress() const { return written.load(memory_order_relaxed); }
+
+    // Wait for the worker and get the result. If the save went through the
+    // buffer it was started from (if given) gets marked as saved.
+    SaveStats wait(TextBuffer* saved = nullptr);
+
+    string name; // File being saved
+    TextBuffer snapshot; // What is being saved
+
+private:
+    thread worker;
+    atomic<bool> done{ false };
+    atomic<size_t> written{ 0 };
+    SaveStats stats;
+};
+
+#endif // SAVE_H
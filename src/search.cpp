@@ -0,0 +1,420 @@
+/*
+*    TextSoup, Yet another text editor
+*    Copyright (C) 2017  Jyry Hjelt
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*/
+// search.cpp
+
+// Include the libraries
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "pool.hpp"
+#include "search.hpp"
+#include "trigram.hpp"
+
+using namespace std;
+
+const size_t SearchEngine::CHUNK_LINES;
+
+// A full scan split into chunks. The workers hold on to it too, so a scan
+// that got cancelled can be dropped without waiting for them.
+struct SearchEngine::Scan {
+    TextBuffer snapshot; // Copy of the buffer, edits don't reach it
+    string query;
+    shared_ptr<const Regex> regex; // Set when query is a pattern
+    vector<vector<SearchHit>> chunks; // Hits of every chunk
+    unique_ptr<atomic<bool>[]> ready; // Which chunks are done
+    size_t merged = 0; // Chunks already moved into the hits
+    atomic<bool> cancelled{ false };
+
+    void search(size_t chunk)
+    {
+        if (cancelled.load(memory_order_relaxed)) {
+            ready[chunk].store(true, memory_order_release);
+            return;
+        }
+
+        vector<SearchHit>& hits = chunks[chunk];
+        size_t first = chunk * CHUNK_LINES;
+        size_t last = min(snapshot.size(), first + CHUNK_LINES);
+        if (regex) {
+            Regex::Matcher matcher = regex->matcher();
+            vector<size_t> starts;
+            snapshot.forEach(first, last, [&](size_t y, LineView line) {
+                starts.clear();
+                matcher.findStarts(line, starts);
+                for (size_t x : starts) {
+                    hits.push_back(SearchHit{ y, x });
+                }
+            });
+        } else {
+            auto f = [&](size_t y, LineView line) {
+                findAll(line, query, [&](size_t x) {
+                    hits.push_back(SearchHit{ y, x });
+                });
+            };
+            // Skip the leaves whose trigrams rule the query out
+            snapshot.forEachLeaf(first, last,
+                [&](size_t y, size_t count, const void*, shared_ptr<const Trigrams> grams) {
+                    if (!grams || grams->mayContain(query))
+                        snapshot.forEach(max(y, first), min(y + count, last), f);
+                });
+        }
+        ready[chunk].store(true, memory_order_release);
+    }
+};
+
+SearchEngine::~SearchEngine()
+{
+    cancel();
+}
+
+void SearchEngine::find(TextBuffer& buffer, const string& query, vector<SearchHit>& hits, bool regex)
+{
+    // Growing the last query on an unchanged buffer only narrows the hits
+    refined = !regex && !lastRegex && done() && lastBuffer == &buffer
+        && lastVersion == buffer.version() && !lastQuery.empty()
+        && query.length() >= lastQuery.length()
+        && query.compare(0, lastQuery.length(), lastQuery) == 0;
+
+    cancel();
+    lastBuffer = &buffer;
+    lastVersion = buffer.version();
+    lastQuery = query;
+    lastRegex = regex;
+    error.clear();
+
+    if (refined) {
+        refine(buffer, query, hits);
+        return;
+    }
+
+    hits.clear();
+    if (query.empty()) {
+        return;
+    }
+
+    shared_ptr<const Regex> pattern;
+    if (regex) {
+        pattern = Regex::compile(query, error);
+        if (!pattern)
+            return;
+    }
+
+    // The workers need every line split out before they start
+    buffer.indexAll();
+    size_t chunks = (buffer.size() + CHUNK_LINES - 1) / CHUNK_LINES;
+
+    scan = make_shared<Scan>();
+    scan->snapshot = buffer;
+    scan->query = query;
+    scan->regex = pattern;
+    scan->chunks.resize(chunks);
+    scan->ready.reset(new atomic<bool>[chunks]);
+    for (size_t i = 0; i < chunks; i++) {
+        scan->ready[i].store(false);
+    }
+
+    // Small buffers aren't worth the trip to the other threads
+    if (chunks <= 1) {
+        for (size_t i = 0; i < chunks; i++) {
+            scan->search(i);
+        }
+    } else {
+        for (size_t i = 0; i < chunks; i++) {
+            shared_ptr<Scan> s = scan;
+            sharedPool().submit([s, i]() { s->search(i); });
+        }
+    }
+    update(hits);
+}
+
+bool SearchEngine::update(vector<SearchHit>& hits)
+{
+    if (!scan) {
+        return false;
+    }
+
+    // Chunks are merged in order, a finished chunk waits for the ones before
+    bool added = false;
+    while (scan->merged < scan->chunks.size()
+        && scan->ready[scan->merged].load(memory_order_acquire)) {
+        vector<SearchHit>& chunk = scan->chunks[scan->merged];
+        hits.insert(hits.end(), chunk.begin(), chunk.end());
+        vector<SearchHit>().swap(chunk);
+        scan->merged++;
+        added = true;
+    }
+
+    if (scan->merged == scan->chunks.size()) {
+        scan.reset(); // Let go of the snapshot
+    }
+    return added;
+}
+
+bool SearchEngine::done() const
+{
+    return !scan;
+}
+
+void SearchEngine::wait(vector<SearchHit>& hits)
+{
+    while (!done()) {
+        if (!update(hits)) {
+            this_thread::sleep_for(chrono::microseconds(200));
+        }
+    }
+}
+
+void SearchEngine::reset()
+{
+    cancel();
+    lastBuffer = nullptr;
+    lastQuery.clear();
+}
+
+void SearchEngine::cancel()
+{
+    if (scan) {
+        scan->cancelled = true;
+        scan.reset();
+    }
+}
+
+void SearchEngine::refine(const TextBuffer& buffer, const string& query, vector<SearchHit>& hits)
+{
+    // Keep the hits where the longer query still matches, in place
+    size_t kept = 0;
+    size_t viewY = 0;
+    LineView line = LineView();
+    for (size_t i = 0; i < hits.size(); i++) {
+        const SearchHit& hit = hits[i];
+        if (i == 0 || hit.y != viewY) {
+            line = buffer.view(hit.y); // Once per line, the hits are in order
+            viewY = hit.y;
+        }
+        if (hit.x + query.length() <= line.size
+            && memcmp(line.data + hit.x, query.data(), query.length()) == 0) {
+            hits[kept++] = hit;
+        }
+    }
+    hits.resize(kept);
+}
+
+namespace {
+
+// Call f(x, length) for the matches in line that get replaced: from the
+// left, not overlapping and not empty. A pattern that matches nothing is
+// tried again from every column after an empty match.
+template <typename F>
+void forEachReplaced(LineView line, const string& query, Regex::Matcher* matcher,
+    vector<size_t>& starts, F f)
+{
+    starts.clear();
+    if (matcher) {
+        matcher->findStarts(line, starts, true);
+        vector<pair<size_t, size_t>> matches;
+        matcher->replaced(line, starts, matches);
+        for (const pair<size_t, size_t>& m : matches) {
+            f(m.first, m.second);
+        }
+        return;
+    }
+
+    size_t done = 0; // End of the last match
+    findAll(line, query, [&](size_t x) {
+        if (x >= done) {
+            f(x, query.length());
+            done = x + query.length();
+        }
+    });
+}
+
+// Rebuild line with every match replaced, false if there were none. The
+// matches are found first and the line is written out once.
+bool replaceLine(LineView line, const string& query, const string& text,
+    Regex::Matcher* matcher, vector<size_t>& starts, string& out, size_t& count)
+{
+    out.clear();
+    size_t done = 0; // Bytes of line already in out
+    forEachReplaced(line, query, matcher, starts, [&](size_t x, size_t length) {
+        out.append(line.data + done, x - done);
+        out += text;
+        done = x + length;
+        count++;
+    });
+    if (done == 0) {
+        return false;
+    }
+    out.append(line.data + done, line.size - done);
+    return true;
+}
+} // namespace
+
+size_t replaceAll(TextBuffer& buffer, const string& query, const string& text, bool regex,
+    Replacement& undo, string& error)
+{
+    error.clear();
+    if (query.empty()) {
+        return 0;
+    }
+    shared_ptr<const Regex> pattern;
+    if (regex) {
+        pattern = Regex::compile(query, error);
+        if (!pattern)
+            return 0;
+    }
+
+    // Chunks of lines for the pool, like a search
+    static const size_t CHUNK = 16384;
+    struct Job {
+        TextBuffer snapshot;
+        vector<vector<pair<size_t, string>>> lines; // The new lines of every chunk
+        vector<size_t> counts;
+        atomic<size_t> next{ 0 }, done{ 0 };
+    };
+    buffer.indexAll();
+    shared_ptr<Job> job = make_shared<Job>();
+    job->snapshot = buffer;
+    size_t chunks = (buffer.size() + CHUNK - 1) / CHUNK;
+    job->lines.resize(chunks);
+    job->counts.resize(chunks);
+
+    // Workers and this thread take chunks until there are none left
+    auto work = [job, chunks, pattern, query, text]() {
+        unique_ptr<Regex::Matcher> matcher;
+        if (pattern) {
+            matcher.reset(new Regex::Matcher(pattern->matcher()));
+        }
+        vector<size_t> starts;
+        string out;
+        size_t chunk;
+        while ((chunk = job->next.fetch_add(1)) < chunks) {
+            size_t first = chunk * CHUNK;
+            size_t last = min(job->snapshot.size(), first + CHUNK);
+            vector<pair<size_t, string>>& lines = job->lines[chunk];
+            auto f = [&](size_t y, LineView line) {
+                if (replaceLine(line, query, text, matcher.get(), starts, out, job->counts[chunk]))
+                    lines.emplace_back(y, out);
+            };
+            // The trigrams rule leaves out for plain text
+            job->snapshot.forEachLeaf(first, last,
+                [&](size_t y, size_t count, const void*, shared_ptr<const Trigrams> grams) {
+                    if (pattern || !grams || grams->mayContain(query))
+                        job->snapshot.forEach(max(y, first), min(y + count, last), f);
+                });
+            job->done.fetch_add(1, memory_order_release);
+        }
+    };
+    size_t helpers = chunks > 1 ? min(sharedPool().size(), chunks) - 1 : 0;
+    for (size_t i = 0; i < helpers; i++) {
+        sharedPool().submit(work);
+    }
+    work();
+    while (job->done.load(memory_order_acquire) < chunks) {
+        this_thread::yield();
+    }
+
+    vector<pair<size_t, string>> changes;
+    size_t count = 0;
+    for (size_t i = 0; i < chunks; i++) {
+        count += job->counts[i];
+        for (pair<size_t, string>& l : job->lines[i]) {
+            changes.push_back(move(l));
+        }
+    }
+    if (changes.empty()) {
+        return 0;
+    }
+
+    undo.before = job->snapshot;
+    undo.lines.clear();
+    for (const pair<size_t, string>& l : changes) {
+        undo.lines.push_back(l.first);
+    }
+    buffer.setLines(move(changes));
+    undo.version = buffer.version();
+    undo.count = count;
+    return count;
+}
+
+bool undoReplace(TextBuffer& buffer, Replacement& undo)
+{
+    if (undo.lines.empty() || buffer.version() != undo.version) {
+        return false;
+    }
+    vector<pair<size_t, string>> old;
+    old.reserve(undo.lines.size());
+    for (size_t y : undo.lines) {
+        old.emplace_back(y, undo.before.line(y));
+    }
+    buffer.setLines(move(old));
+    undo = Replacement();
+    return true;
+}
+
+void replaceableHits(const TextBuffer& buffer, const string& query, bool regex, vector<SearchHit>& hits)
+{
+    if (!regex) {
+        return;
+    }
+    string error;
+    shared_ptr<const Regex> pattern = Regex::compile(query, error);
+    if (!pattern || !pattern->matchesEmpty()) {
+        return;
+    }
+
+    // The search kept one empty match a line, the lines are looked at again
+    Regex::Matcher matcher = pattern->matcher();
+    vector<SearchHit> found;
+    vector<size_t> starts;
+    for (size_t i = 0; i < hits.size(); i++) {
+        size_t y = hits[i].y;
+        if (i > 0 && hits[i - 1].y == y) {
+            continue;
+        }
+        forEachReplaced(buffer.view(y), query, &matcher, starts, [&](size_t x, size_t) {
+            found.push_back(SearchHit{ y, x });
+        });
+    }
+    hits.swap(found);
+}
+
+size_t matchLength(const TextBuffer& buffer, SearchHit hit, const string& query, bool regex)
+{
+    if (hit.y >= buffer.size()) {
+        return string::npos;
+    }
+    LineView line = buffer.view(hit.y);
+    if (hit.x > line.size) {
+        return string::npos;
+    }
+    if (!regex) {
+        bool there = hit.x + query.length() <= line.size
+            && memcmp(line.data + hit.x, query.data(), query.length()) == 0;
+        return there ? query.length() : string::npos;
+    }
+    string error;
+    shared_ptr<const Regex> pattern = Regex::compile(query, error);
+    if (!pattern) {
+        return string::npos;
+    }
+    return pattern->matcher().matchLength(line, hit.x);
+}
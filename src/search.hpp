@@ -0,0 +1,160 @@
+// search.hpp
+#ifndef SEARCH_H
+#define SEARCH_H
+
+// Searching the text buffer
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "buffer.hpp"
+#include "regex.hpp"
+
+using namespace std;
+
+// A place where the query was found
+struct SearchHit {
+    size_t y; // Line
+    size_t x; // Column
+};
+
+// Searches the buffer for every match of a query.
+//
+// Incremental: when the query only grows, the new matches are a subset of
+// the old ones (every match of "abc" starts with a match of "ab"), so only
+// the previous hits are checked again. A shorter or different query or an
+// edited buffer means a scan over the whole buffer.
+//
+// Regular expressions: with regex set the query is a pattern (regex.hpp).
+// It's compiled once, a longer pattern can match more so it's always a full
+// scan.
+//
+// Indexed: leaves with a trigram index (trigram.hpp) that rules the query
+// out aren't read at all.
+//
+// Parallel: a full scan of a big buffer is cut into chunks of lines which
+// the shared thread pool searches from a snapshot of the buffer. update()
+// moves the chunks that are done into the hits in order, so the first hits
+// can be shown while the rest of the buffer is still being searched.
+class SearchEngine {
+public:
+    ~SearchEngine();
+
+    // Start looking for query in buffer, hits gets what is found right away
+    void find(TextBuffer& buffer, const string& query, vector<SearchHit>& hits, bool regex = false);
+    bool update(vector<SearchHit>& hits); // Add finished chunks, true if any
+    bool done() const; // Has the whole buffer been searched?
+    void wait(vector<SearchHit>& hits); // Finish the search
+    void reset(); // Forget the last search
+
+    bool refined = false; // Was the last find answered from the last hits?
+    string error; // Why the last pattern didn't compile ("" if it did)
+
+private:
+    static const size_t CHUNK_LINES = 16384; // Lines searched per task
+
+    struct Scan;
+    shared_ptr<Scan> scan; // The running parallel scan (shared with workers)
+
+    const TextBuffer* lastBuffer = nullptr;
+    uint64_t lastVersion = 0;
+    string lastQuery;
+    bool lastRegex = false;
+
+    void cancel();
+    static void refine(const TextBuffer& buffer, const string& query, vector<SearchHit>& hits);
+};
+
+// Replacing matches. The matches in a line are replaced from the left and
+// don't overlap, a match of a pattern is its longest one. The text goes in
+// as it is, and matches of nothing are left alone: after one the pattern is
+// tried from the next column.
+//
+// A replace-all is one step: every line with a match is rebuilt in one pass
+// on the thread pool from a snapshot of the buffer, and then they are all
+// set in one walk over the buffer. The snapshot is kept so the whole step
+// can be undone until the buffer is edited again.
+struct Replacement {
+    TextBuffer before; // The buffer as it was before
+    vector<size_t> lines; // The lines that changed
+    uint64_t version = 0; // The buffer's version right after
+    size_t count = 0; // Matches replaced
+};
+
+// Replace every match of query in buffer with text, undo gets what is needed
+// to take it back. Gives how many matches were replaced, error is set when
+// the pattern doesn't compile.
+size_t replaceAll(TextBuffer& buffer, const string& query, const string& text, bool regex,
+    Replacement& undo, string& error);
+// Put the lines of the last replace-all back, false if the buffer has been
+// edited since (or there is nothing to undo)
+bool undoReplace(TextBuffer& buffer, Replacement& undo);
+// Turn the hits of a search into the matches a replace goes through one at
+// a time. Only a pattern that matches nothing needs it: its hits are the
+// first empty match of every line, the matches that aren't empty are found
+// on those lines instead.
+void replaceableHits(const TextBuffer& buffer, const string& query, bool regex, vector<SearchHit>& hits);
+// Length of the match of query at hit, npos if it doesn't match there any
+// more
+size_t matchLength(const TextBuffer& buffer, SearchHit hit, const string& query, bool regex);
+
+// Find the first place in [p, end) where the needle starts. The SSE2 loop
+// checks 16 positions at a time for the needle's first and last byte and only
+// compares the middle where both match.
+inline const char* findNext(const char* p, const char* end, const char* needle, size_t n)
+{
+#ifdef __SSE2__
+    if (n >= 2) {
+        const __m128i first = _mm_set1_epi8(needle[0]);
+        const __m128i last = _mm_set1_epi8(needle[n - 1]);
+        while (end - p >= ptrdiff_t(n + 15)) {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + n - 1));
+            unsigned int mask = _mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+            while (mask) {
+                int bit = __builtin_ctz(mask);
+                if (memcmp(p + bit + 1, needle + 1, n - 2) == 0)
+                    return p + bit;
+                mask &= mask - 1;
+            }
+            p += 16;
+        }
+    }
+#endif
+
+    // The rest (and short lines): memchr for the first byte
+    while (end - p >= ptrdiff_t(n)) {
+        p = static_cast<const char*>(memchr(p, needle[0], end - p - n + 1));
+        if (!p)
+            return nullptr;
+        if (memcmp(p + 1, needle + 1, n - 1) == 0)
+            return p;
+        p++;
+    }
+    return nullptr;
+}
+
+// Call f(x) for every place in line where query starts, overlapping ones too
+template <typename F>
+void findAll(LineView line, const string& query, F f)
+{
+    if (query.empty())
+        return;
+
+    const char* p = line.data;
+    const char* end = line.data + line.size;
+    while ((p = findNext(p, end, query.data(), query.length()))) {
+        f(size_t(p - line.data));
+        p++;
+    }
+}
+
+#endif // SEARCH_H
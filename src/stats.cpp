@@ -0,0 +1,239 @@
+/*
+*    TextSoup, Yet another text editor
+*    Copyright (C) 2017  Jyry Hjelt
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*/
+// stats.cpp
+
+// Include the libraries
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <math.h>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "logging.hpp"
+#include "stats.hpp"
+
+using namespace std;
+
+namespace {
+
+const int SUB_BITS = Stats::Histogram::SUB_BITS;
+const uint64_t SUB = uint64_t(1) << SUB_BITS;
+
+// The bucket of a duration: the position of the top bit and the bits
+// right below it
+size_t bucketOf(uint64_t ns)
+{
+    if (ns < SUB) {
+        return size_t(ns);
+    }
+    int top = 63 - __builtin_clzll(ns);
+    return size_t(top - SUB_BITS + 1) * SUB + ((ns >> (top - SUB_BITS)) & (SUB - 1));
+}
+
+// The longest duration that falls into a bucket
+uint64_t bucketTop(size_t bucket)
+{
+    if (bucket < SUB) {
+        return bucket;
+    }
+    int top = int(bucket / SUB) + SUB_BITS - 1;
+    uint64_t low = (SUB + bucket % SUB) << (top - SUB_BITS);
+    return low + (uint64_t(1) << (top - SUB_BITS)) - 1;
+}
+
+// Bump a maximum that other threads may be bumping too
+void raiseTo(atomic<uint64_t>& value, uint64_t to)
+{
+    uint64_t now = value.load(memory_order_relaxed);
+    while (to > now && !value.compare_exchange_weak(now, to, memory_order_relaxed)) {
+    }
+}
+
+Stats::Histogram histograms[Stats::STAGES];
+
+// The startup phases, the file is read on a thread of its own
+struct Phase {
+    const char* name;
+    Stats::Timer::Clock::time_point began, ended;
+};
+mutex phaseLock;
+bool tracing = false;
+Stats::Timer::Clock::time_point traceStart;
+vector<Phase> phases;
+
+double millis(Stats::Timer::Clock::duration d)
+{
+    return chrono::duration_cast<chrono::microseconds>(d).count() / 1e3;
+}
+
+string shortTime(uint64_t ns)
+{
+    char text[32];
+    if (ns < 1000000) {
+        snprintf(text, sizeof(text), "%.0f us", ns / 1e3);
+    } else {
+        snprintf(text, sizeof(text), "%.1f ms", ns / 1e6);
+    }
+    return text;
+}
+} // namespace
+
+namespace Stats {
+
+const int Histogram::SUB_BITS;
+const size_t Histogram::BUCKETS;
+
+const char* stageName(Stage stage)
+{
+    switch (stage) {
+    case KEY:
+        return "key";
+    case EDIT:
+        return "edit";
+    case DRAW:
+        return "draw";
+    case SEARCH:
+        return "search";
+    case LOAD:
+        return "load";
+    case SAVE:
+        return "save";
+    case STAGES:
+        break;
+    }
+    return "?";
+}
+
+Histogram::Histogram()
+{
+    for (size_t i = 0; i < BUCKETS; i++) {
+        buckets[i].store(0, memory_order_relaxed);
+    }
+    total.store(0, memory_order_relaxed);
+    sum.store(0, memory_order_relaxed);
+    latest.store(0, memory_order_relaxed);
+    longest.store(0, memory_order_relaxed);
+}
+
+void Histogram::record(uint64_t ns)
+{
+    buckets[bucketOf(ns)].fetch_add(1, memory_order_relaxed);
+    total.fetch_add(1, memory_order_relaxed);
+    sum.fetch_add(ns, memory_order_relaxed);
+    latest.store(ns, memory_order_relaxed);
+    raiseTo(longest, ns);
+}
+
+double Histogram::mean() const
+{
+    uint64_t n = count();
+    return n ? double(sum.load(memory_order_relaxed)) / n : 0;
+}
+
+uint64_t Histogram::percentile(double p) const
+{
+    // Counts may move while they're read, the answer is close enough
+    uint64_t n = count();
+    if (n == 0) {
+        return 0;
+    }
+    uint64_t rank = std::max(uint64_t(ceil(p * n)), uint64_t(1)); // Nearest rank
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        seen += buckets[i].load(memory_order_relaxed);
+        if (seen >= rank) {
+            return min(bucketTop(i), max());
+        }
+    }
+    return max();
+}
+
+Histogram& histogram(Stage stage)
+{
+    return histograms[stage];
+}
+
+Timer::~Timer()
+{
+    if (active) {
+        uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count();
+        histograms[stage].record(ns);
+    }
+}
+
+string overlay()
+{
+    return "frame " + shortTime(histograms[DRAW].last()) + ", p99 key "
+        + shortTime(histograms[KEY].percentile(0.99)) + " draw "
+        + shortTime(histograms[DRAW].percentile(0.99));
+}
+
+void logReport()
+{
+    if (!Logging::enabled(Logging::INFO)) {
+        return;
+    }
+    for (int s = 0; s < STAGES; s++) {
+        const Histogram& h = histograms[s];
+        if (h.count() == 0) {
+            continue;
+        }
+        char line[256];
+        snprintf(line, sizeof(line),
+            "Timing %-6s n=%llu mean=%.1fus p50=%.1fus p90=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus",
+            stageName(Stage(s)), (unsigned long long)h.count(), h.mean() / 1e3,
+            h.percentile(0.5) / 1e3, h.percentile(0.9) / 1e3, h.percentile(0.99) / 1e3,
+            h.percentile(0.999) / 1e3, h.max() / 1e3);
+        Logging::logEntry(line, Logging::INFO);
+    }
+}
+
+void traceStartup()
+{
+    lock_guard<mutex> guard(phaseLock);
+    tracing = true;
+    traceStart = Timer::Clock::now();
+}
+
+void startupPhase(const char* name, Timer::Clock::time_point began)
+{
+    Timer::Clock::time_point now = Timer::Clock::now();
+    lock_guard<mutex> guard(phaseLock);
+    if (tracing) {
+        phases.push_back(Phase{ name, began, now });
+    }
+}
+
+string startupReport()
+{
+    lock_guard<mutex> guard(phaseLock);
+    string report;
+    Timer::Clock::time_point last = traceStart;
+    for (const Phase& phase : phases) {
+        char line[128];
+        snprintf(line, sizeof(line), "%-14s %8.2f ms   (%.2f to %.2f ms)\n", phase.name,
+            millis(phase.ended - phase.began), millis(phase.began - traceStart),
+            millis(phase.ended - traceStart));
+        report += line;
+        last = std::max(last, phase.ended);
+    }
+    char line[64];
+    snprintf(line, sizeof(line), "%-14s %8.2f ms\n", "total", millis(last - traceStart));
+    return report + line;
+}
+} // Stats
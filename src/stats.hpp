@@ -0,0 +1,90 @@
+// stats.hpp
+#ifndef STATS_H
+#define STATS_H
+
+// Timing of the editor's hot paths
+//
+// Every stage has a histogram of how long it took. Recording is a few
+// relaxed atomic adds, so it is safe from any thread (saves run on their
+// own) and cheap enough to leave on all the time.
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <string>
+
+using namespace std;
+
+namespace Stats {
+
+// The stages that are timed
+enum Stage { KEY, // Handling a key in the main loop
+    EDIT, // Changing the buffer for a key or a paste
+    DRAW, // updateScr
+    SEARCH, // searchFile
+    LOAD, // getFileLines
+    SAVE, // writeToFile
+    STAGES };
+
+const char* stageName(Stage stage);
+
+// Log-linear histogram of nanoseconds: a power of two is split in 8
+// buckets, so a percentile is off by at most 12.5%
+class Histogram {
+public:
+    static const int SUB_BITS = 3;
+    static const size_t BUCKETS = (65 - SUB_BITS) << SUB_BITS;
+
+    Histogram();
+
+    void record(uint64_t ns);
+    uint64_t count() const { return total.load(memory_order_relaxed); }
+    uint64_t last() const { return latest.load(memory_order_relaxed); }
+    uint64_t max() const { return longest.load(memory_order_relaxed); }
+    double mean() const; // Nanoseconds
+    uint64_t percentile(double p) const; // Nanoseconds, 0 if empty
+
+private:
+    atomic<uint64_t> buckets[BUCKETS];
+    atomic<uint64_t> total, sum, latest, longest;
+};
+
+Histogram& histogram(Stage stage);
+
+// Times its own lifetime into a stage
+class Timer {
+public:
+    typedef chrono::steady_clock Clock;
+
+    explicit Timer(Stage STAGE)
+        : stage(STAGE)
+        , start(Clock::now())
+    {
+    }
+    ~Timer();
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+    void cancel() { active = false; } // Don't record this one
+
+private:
+    Stage stage;
+    Clock::time_point start;
+    bool active = true;
+};
+
+// Short text for the status bar: the last frame and the p99 of keys and
+// frames
+string overlay();
+
+// Log the percentiles of every stage that ran
+void logReport();
+
+// Startup phases for --trace-startup. A phase runs from when it began to
+// when it is marked, so phases that overlap (reading the file while the
+// terminal starts) show up as they happened. Nothing is kept unless
+// traceStartup() was called.
+void traceStartup(); // Start keeping them, times are from now
+void startupPhase(const char* name, Timer::Clock::time_point began);
+string startupReport(); // A line per phase, in the order they ended
+} // Stats
+#endif // STATS_H
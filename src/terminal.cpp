@@ -0,0 +1,250 @@
+/*
+*    TextSoup, Yet another text editor
+*    Copyright (C) 2017  Jyry Hjelt
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*/
+// terminal.cpp
+
+// Include the libraries
+#include <chrono>
+#include <ncurses.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "editor.h"
+#include "highlight.hpp"
+#include "terminal.hpp"
+#include "utf8.hpp"
+
+using namespace std;
+
+CursesTerminal::CursesTerminal()
+{
+    initscr(); // The locale is set by main(), so UTF-8 is drawn as characters
+    raw();
+    keypad(stdscr, TRUE);
+    noecho();
+    curs_set(FALSE);
+    start_color();
+
+    // Initialize colour pairs for different colours
+    init_pair(1, COLOR_BLACK, COLOR_WHITE); // Inverted colour pair (cursor)
+
+    // Highlight::Colour c is drawn with pair c + 1, on the terminal's own background
+    use_default_colors();
+    const short highlights[Highlight::COLOURS] = { -1, COLOR_YELLOW, COLOR_GREEN, COLOR_RED,
+        COLOR_CYAN, COLOR_BLUE, COLOR_MAGENTA, COLOR_RED, COLOR_YELLOW, COLOR_GREEN };
+    for (short c = 1; c < Highlight::COLOURS; c++) {
+        init_pair(c + 1, highlights[c], -1);
+    }
+
+    // Ask for pastes to be wrapped in ESC[200~ and ESC[201~
+    printf("\033[?2004h");
+    fflush(stdout);
+}
+
+CursesTerminal::~CursesTerminal()
+{
+    printf("\033[?2004l");
+    fflush(stdout);
+    endwin(); // End the ncurses session
+}
+
+int CursesTerminal::getKey(int timeoutMs)
+{
+    timeout(timeoutMs);
+    int key = getch();
+    if (key == 27 && follows("[200~")) {
+        readPaste();
+        return KEY_PASTE;
+    }
+    return key;
+}
+
+void CursesTerminal::ungetKey(int key)
+{
+    ungetch(key);
+}
+
+bool CursesTerminal::follows(const char* sequence)
+{
+    // The rest of an escape sequence is already waiting if it's there
+    timeout(0);
+    vector<int> read;
+    for (const char* c = sequence; *c; c++) {
+        int key = getch();
+        if (key == ERR) {
+            break;
+        }
+        read.push_back(key);
+        if (key != *c) {
+            break;
+        }
+    }
+    if (read.size() == strlen(sequence) && read.back() == sequence[read.size() - 1]) {
+        return true;
+    }
+
+    // Not it, the keys go back in the order they came
+    for (size_t i = read.size(); i > 0; i--) {
+        ungetch(read[i - 1]);
+    }
+    return false;
+}
+
+void CursesTerminal::readPaste()
+{
+    static const char end[] = "\033[201~";
+    const size_t endLength = sizeof(end) - 1;
+
+    pasted.clear();
+    timeout(100); // A paste that never ends is given up on
+    int key;
+    while ((key = getch()) != ERR) {
+        pasted += char(key);
+        if (key == '~' && pasted.length() >= endLength
+            && pasted.compare(pasted.length() - endLength, endLength, end) == 0) {
+            pasted.resize(pasted.length() - endLength);
+            break;
+        }
+    }
+}
+
+void CursesTerminal::size(unsigned int& rows, unsigned int& cols)
+{
+    getmaxyx(stdscr, rows, cols);
+}
+
+void CursesTerminal::clearScreen()
+{
+    clear();
+}
+
+void CursesTerminal::drawRow(unsigned int y, unsigned int cols, const ScreenRow& row)
+{
+    move(y, 0);
+    clrtoeol();
+
+    if (row.rule) {
+        mvhline(y, 0, ACS_HLINE, cols);
+        return;
+    }
+
+    if (row.inverted) {
+        attron(COLOR_PAIR(1));
+        addnstr(row.text.data(), row.text.length());
+        attroff(COLOR_PAIR(1));
+        return;
+    }
+
+    if (row.cursor < 0 || size_t(row.cursor) >= row.text.length()) {
+        drawText(row, 0, row.text.length());
+        return;
+    }
+
+    // Draw the text around the cursor in one piece on both sides, the
+    // cursor takes all the bytes of its character
+    size_t after = Utf8::next(row.text.data(), row.text.length(), row.cursor);
+    drawText(row, 0, row.cursor);
+    attron(COLOR_PAIR(1));
+    addnstr(row.text.data() + row.cursor, after - row.cursor);
+    attroff(COLOR_PAIR(1));
+    drawText(row, after, row.text.length());
+}
+
+void CursesTerminal::drawText(const ScreenRow& row, size_t from, size_t to)
+{
+    // A run of bytes with the same colour at a time
+    while (from < to) {
+        uint8_t colour = from < row.colours.size() ? row.colours[from] : 0;
+        size_t end = from + 1;
+        while (end < to && (end < row.colours.size() ? row.colours[end] : 0) == colour)
+            end++;
+        if (colour) {
+            attron(COLOR_PAIR(colour + 1));
+        }
+        addnstr(row.text.data() + from, end - from);
+        if (colour) {
+            attroff(COLOR_PAIR(colour + 1));
+        }
+        from = end;
+    }
+}
+
+void CursesTerminal::show()
+{
+    refresh();
+}
+
+HeadlessTerminal::HeadlessTerminal(unsigned int rows, unsigned int cols)
+    : rows(rows)
+    , cols(cols)
+{
+}
+
+void HeadlessTerminal::play(const vector<int>& KEYS, size_t from, const vector<string>& PASTES)
+{
+    keys = KEYS;
+    pastes = PASTES;
+    ungot.clear();
+    next = 0;
+    nextPaste = 0;
+    measureFrom = from;
+    latencies.clear();
+    latencies.reserve(keys.size());
+    firstKey = -1;
+    rowsDrawn = 0;
+    started = Clock::now();
+}
+
+int HeadlessTerminal::getKey(int timeoutMs)
+{
+    if (!ungot.empty()) {
+        int key = ungot.back();
+        ungot.pop_back();
+        return key;
+    }
+    if (timeoutMs == 0) {
+        return ERR; // Nothing typed ahead
+    }
+
+    Clock::time_point now = Clock::now();
+    if (next == 0) {
+        firstKey = chrono::duration<double>(now - started).count();
+    } else if (next > measureFrom && next <= keys.size()) {
+        latencies.push_back(chrono::duration<double>(now - handedOut).count());
+    }
+
+    // Out of keys: cancel whatever is open and quit without saving. This
+    // gets the editor out of any prompt in a few rounds.
+    int key;
+    if (next < keys.size()) {
+        key = keys[next];
+    } else {
+        static const int quit[] = { C, Q, 'n' };
+        key = quit[(next - keys.size()) % 3];
+    }
+    next++;
+    if (key == KEY_PASTE) {
+        pasted = nextPaste < pastes.size() ? pastes[nextPaste++] : "";
+    }
+    handedOut = Clock::now();
+    return key;
+}
+
+void HeadlessTerminal::size(unsigned int& r, unsigned int& c)
+{
+    r = rows;
+    c = cols;
+}
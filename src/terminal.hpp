@@ -0,0 +1,91 @@
+// terminal.hpp
+#ifndef TERMINAL_H
+#define TERMINAL_H
+
+// Where the editor gets its keys from and draws its rows to
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "render.hpp"
+
+using namespace std;
+
+// getKey() gives this for a paste, the text is in Terminal::pasted
+#define KEY_PASTE 0x10000
+
+class Terminal {
+public:
+    virtual ~Terminal() {}
+
+    // Wait for a key for up to timeoutMs (-1 waits for ever, 0 only takes
+    // keys that are already waiting), ERR if none
+    virtual int getKey(int timeoutMs = -1) = 0;
+    virtual void ungetKey(int key) = 0; // Give a key back to the next getKey
+    virtual void size(unsigned int& rows, unsigned int& cols) = 0;
+
+    // Drawing, see Renderer
+    virtual void clearScreen() = 0;
+    virtual void drawRow(unsigned int y, unsigned int cols, const ScreenRow& row) = 0;
+    virtual void show() = 0; // Put what was drawn on the screen
+
+    string pasted; // Text of the last KEY_PASTE
+};
+
+// The real terminal through ncurses. Bracketed paste is turned on, so a
+// paste comes as one KEY_PASTE instead of a key per character.
+class CursesTerminal : public Terminal {
+public:
+    CursesTerminal(); // Takes over the terminal, set the locale before
+    ~CursesTerminal(); // Gives it back
+
+    int getKey(int timeoutMs = -1);
+    void ungetKey(int key);
+    void size(unsigned int& rows, unsigned int& cols);
+    void clearScreen();
+    void drawRow(unsigned int y, unsigned int cols, const ScreenRow& row);
+    void show();
+
+private:
+    bool follows(const char* sequence); // Do these keys come next?
+    void readPaste(); // Read into pasted up to the end of the paste
+    void drawText(const ScreenRow& row, size_t from, size_t to); // In its colours
+};
+
+// A terminal without a screen that plays back a list of keys, for running
+// the editor in benchmarks. It times how long the editor takes to come back
+// for the next key after each one. Keys are never waiting already (like
+// with someone typing), and every KEY_PASTE takes the next of pastes.
+class HeadlessTerminal : public Terminal {
+public:
+    HeadlessTerminal(unsigned int rows, unsigned int cols);
+
+    // Keys to hand out. The ones from measureFrom on are timed.
+    void play(const vector<int>& keys, size_t measureFrom = 0,
+        const vector<string>& pastes = vector<string>());
+
+    int getKey(int timeoutMs = -1);
+    void ungetKey(int key) { ungot.push_back(key); }
+    void size(unsigned int& rows, unsigned int& cols);
+    void clearScreen() {}
+    void drawRow(unsigned int, unsigned int, const ScreenRow&) { rowsDrawn++; }
+    void show() {}
+
+    vector<double> latencies; // Seconds it took to handle each timed key
+    double firstKey = -1; // Seconds from play() to the first key asked for
+    size_t rowsDrawn = 0;
+
+private:
+    typedef chrono::steady_clock Clock;
+
+    unsigned int rows, cols;
+    vector<int> keys;
+    vector<string> pastes;
+    vector<int> ungot; // Given back by the editor
+    size_t next = 0;
+    size_t nextPaste = 0;
+    size_t measureFrom = 0;
+    Clock::time_point started, handedOut;
+};
+
+#endif // TERMINAL_H
@@ -0,0 +1,232 @@
+/*
+*    TextSoup, Yet another text editor
+*    Copyright (C) 2017  Jyry Hjelt
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*/
+// trigram.cpp
+
+// Include the libraries
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "pool.hpp"
+#include "trigram.hpp"
+
+using namespace std;
+
+const size_t TrigramIndex::LEAVES_PER_TASK;
+
+namespace {
+
+// Two bits of the filter for every trigram
+inline void bitsOf(uint32_t gram, uint64_t mask, uint64_t& a, uint64_t& b)
+{
+    uint64_t h = gram * 0x9e3779b97f4a7c15ull;
+    a = (h >> 32) & mask;
+    b = h & mask;
+}
+} // namespace
+
+shared_ptr<const Trigrams> Trigrams::build(const TextBuffer& buffer, size_t y, size_t count)
+{
+    size_t bytes = 0;
+    buffer.forEach(y, y + count, [&](size_t, LineView line) {
+        bytes += line.size;
+    });
+
+    // About a bit per byte keeps false positives rare for a query of a few
+    // trigrams, real text has far fewer distinct trigrams than bytes
+    size_t size = 512;
+    while (size < bytes)
+        size *= 2;
+    shared_ptr<Trigrams> grams = make_shared<Trigrams>();
+    grams->bits.assign(size / 64, 0);
+    uint64_t mask = size - 1;
+
+    buffer.forEach(y, y + count, [&](size_t, LineView line) {
+        uint32_t gram = 0;
+        for (size_t i = 0; i < line.size; i++) {
+            gram = ((gram << 8) | (unsigned char)line.data[i]) & 0xffffff;
+            if (i >= 2) {
+                uint64_t a, b;
+                bitsOf(gram, mask, a, b);
+                grams->bits[a / 64] |= 1ull << (a % 64);
+                grams->bits[b / 64] |= 1ull << (b % 64);
+            }
+        }
+    });
+    return grams;
+}
+
+bool Trigrams::mayContain(const string& query) const
+{
+    uint64_t mask = bits.size() * 64 - 1;
+    uint32_t gram = 0;
+    for (size_t i = 0; i < query.length(); i++) {
+        gram = ((gram << 8) | (unsigned char)query[i]) & 0xffffff;
+        if (i >= 2) {
+            uint64_t a, b;
+            bitsOf(gram, mask, a, b);
+            if (!(bits[a / 64] & (1ull << (a % 64))) || !(bits[b / 64] & (1ull << (b % 64))))
+                return false;
+        }
+    }
+    return true;
+}
+
+// A build running on the pool. The first task lists the leaves, then the
+// leaves are indexed LEAVES_PER_TASK at a time.
+struct TrigramIndex::Build {
+    struct Leaf {
+        size_t y, count;
+        const void* id;
+        shared_ptr<const Trigrams> grams;
+        bool fresh; // Indexed by this build
+    };
+
+    TextBuffer snapshot;
+    vector<Leaf> leaves;
+    atomic<size_t> remaining{ 0 }; // Tasks still running
+    atomic<size_t> textBytes{ 0 };
+    atomic<bool> cancelled{ false };
+    atomic<bool> ready{ false };
+    chrono::steady_clock::time_point began;
+    double seconds = 0;
+
+    void plan(shared_ptr<Build> self)
+    {
+        snapshot.forEachLeaf(0, snapshot.size(),
+            [&](size_t y, size_t count, const void* id, shared_ptr<const Trigrams> grams) {
+                leaves.push_back(Leaf{ y, count, id, move(grams), false });
+            });
+
+        size_t tasks = (leaves.size() + LEAVES_PER_TASK - 1) / LEAVES_PER_TASK;
+        if (tasks == 0) {
+            finish();
+            return;
+        }
+        remaining = tasks;
+        for (size_t i = 0; i < tasks; i++) {
+            sharedPool().submit([self, i]() { self->index(i); });
+        }
+    }
+
+    void index(size_t task)
+    {
+        size_t first = task * LEAVES_PER_TASK;
+        size_t last = min(leaves.size(), first + LEAVES_PER_TASK);
+        size_t bytes = 0;
+        for (size_t i = first; i < last && !cancelled.load(memory_order_relaxed); i++) {
+            Leaf& leaf = leaves[i];
+            snapshot.forEach(leaf.y, leaf.y + leaf.count, [&](size_t, LineView line) {
+                bytes += line.size;
+            });
+            if (!leaf.grams) {
+                leaf.grams = Trigrams::build(snapshot, leaf.y, leaf.count);
+                leaf.fresh = true;
+            }
+        }
+        textBytes.fetch_add(bytes, memory_order_relaxed);
+
+        if (remaining.fetch_sub(1, memory_order_acq_rel) == 1) {
+            finish();
+        }
+    }
+
+    void finish()
+    {
+        seconds = chrono::duration<double>(chrono::steady_clock::now() - began).count();
+        ready.store(true, memory_order_release);
+    }
+};
+
+TrigramIndex::~TrigramIndex()
+{
+    if (job) {
+        job->cancelled = true;
+    }
+}
+
+void TrigramIndex::start(TextBuffer& buffer)
+{
+    if (running()) {
+        return;
+    }
+
+    // The leaves have to be split out of the mapping before they're listed
+    buffer.indexAll();
+    lastBuffer = &buffer;
+    lastVersion = buffer.version();
+
+    job = make_shared<Build>();
+    job->snapshot = buffer;
+    job->began = chrono::steady_clock::now();
+    shared_ptr<Build> b = job;
+    sharedPool().submit([b]() { b->plan(b); });
+}
+
+bool TrigramIndex::poll(TextBuffer& buffer)
+{
+    if (!job || !job->ready.load(memory_order_acquire)) {
+        return false;
+    }
+
+    // Leaves edited since the snapshot are new nodes by now and don't match
+    unordered_map<const void*, shared_ptr<const Trigrams>> grams;
+    indexBytes = 0;
+    built = 0;
+    for (Build::Leaf& leaf : job->leaves) {
+        if (leaf.grams)
+            indexBytes += leaf.grams->bytes();
+        if (leaf.fresh) {
+            grams[leaf.id] = leaf.grams;
+            built++;
+        }
+    }
+    if (&buffer == lastBuffer) {
+        buffer.setGrams(grams);
+    }
+
+    textBytes = job->textBytes;
+    seconds = job->seconds;
+    job.reset();
+    return true;
+}
+
+bool TrigramIndex::outdated(const TextBuffer& buffer) const
+{
+    return &buffer != lastBuffer || buffer.version() != lastVersion;
+}
+
+void TrigramIndex::reset(TextBuffer& buffer)
+{
+    if (job) {
+        job->cancelled = true;
+        job.reset();
+    }
+    buffer.clearGrams();
+    lastBuffer = nullptr;
+}
+
+string TrigramIndex::summary() const
+{
+    char msg[128];
+    snprintf(msg, sizeof(msg), "Search index: %.1f MB for %.1f MB of text (%.0f%%), %zu leaves in %.2f s",
+        indexBytes / 1e6, textBytes / 1e6, textBytes ? 100.0 * indexBytes / textBytes : 0.0,
+        built, seconds);
+    return msg;
+}
@@ -0,0 +1,64 @@
+// trigram.hpp
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+
+// Trigram index for searching big buffers
+//
+// Every leaf of a TextBuffer can carry a Trigrams: a Bloom filter of the
+// three byte sequences in its lines. A query of three bytes or more can only
+// be in a leaf whose filter has all of the query's trigrams, so most leaves
+// are skipped without reading their text. Edits drop the filter of the leaf
+// they change, the search just reads those leaves until they're indexed
+// again.
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "buffer.hpp"
+
+using namespace std;
+
+struct Trigrams {
+    vector<uint64_t> bits;
+
+    // Index count lines of buffer starting from line y
+    static shared_ptr<const Trigrams> build(const TextBuffer& buffer, size_t y, size_t count);
+    bool mayContain(const string& query) const; // false if query can't be there
+    size_t bytes() const { return sizeof(Trigrams) + bits.size() * sizeof(uint64_t); }
+};
+
+// Builds the index of a buffer on the shared thread pool from a snapshot and
+// hands it to the buffer once it's done. Only leaves without an index are
+// indexed, so keeping the index up to date after edits is cheap.
+class TrigramIndex {
+public:
+    ~TrigramIndex();
+
+    bool enabled = false;
+
+    void start(TextBuffer& buffer); // Index what isn't indexed yet
+    bool running() const { return bool(job); }
+    bool poll(TextBuffer& buffer); // Hand over a finished build, true if done
+    bool outdated(const TextBuffer& buffer) const; // Edited since the last build?
+    void reset(TextBuffer& buffer); // Stop and drop the index of buffer
+
+    string summary() const; // Size and build time of the last build
+
+private:
+    static const size_t LEAVES_PER_TASK = 64;
+
+    struct Build;
+    shared_ptr<Build> job; // Shared with the workers
+
+    const TextBuffer* lastBuffer = nullptr;
+    uint64_t lastVersion = 0;
+
+    // Stats of the last build
+    size_t indexBytes = 0; // Size of the whole index
+    size_t textBytes = 0; // Size of the text
+    size_t built = 0; // Leaves indexed
+    double seconds = 0;
+};
+
+#endif // TRIGRAM_H
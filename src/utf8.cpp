@@ -0,0 +1,233 @@
+/*
+*    TextSoup, Yet another text editor
+*    Copyright (C) 2017  Jyry Hjelt
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*/
+// utf8.cpp
+
+// Include the libraries
+#include <algorithm>
+#include <stdint.h>
+#include <string>
+
+#include "utf8.hpp"
+
+using namespace std;
+
+namespace {
+
+struct Range {
+    uint32_t first, last;
+};
+
+// Combining marks and other characters that take no column of their own
+const Range zeroWidth[] = {
+    { 0x0300, 0x036F }, { 0x0483, 0x0489 }, { 0x0591, 0x05BD }, { 0x05BF, 0x05BF },
+    { 0x05C1, 0x05C2 }, { 0x05C4, 0x05C5 }, { 0x05C7, 0x05C7 }, { 0x0610, 0x061A },
+    { 0x064B, 0x065F }, { 0x0670, 0x0670 }, { 0x06D6, 0x06DC }, { 0x06DF, 0x06E4 },
+    { 0x06E7, 0x06E8 }, { 0x06EA, 0x06ED }, { 0x0711, 0x0711 }, { 0x0730, 0x074A },
+    { 0x0900, 0x0902 }, { 0x093A, 0x093A }, { 0x093C, 0x093C }, { 0x0941, 0x0948 },
+    { 0x094D, 0x094D }, { 0x0951, 0x0957 }, { 0x0E31, 0x0E31 }, { 0x0E34, 0x0E3A },
+    { 0x0E47, 0x0E4E }, { 0x1160, 0x11FF }, { 0x1AB0, 0x1AFF }, { 0x1DC0, 0x1DFF },
+    { 0x200B, 0x200F }, { 0x202A, 0x202E }, { 0x2060, 0x2064 }, { 0x20D0, 0x20FF },
+    { 0xFE00, 0xFE0F }, { 0xFE20, 0xFE2F }, { 0xFEFF, 0xFEFF }, { 0xE0100, 0xE01EF },
+};
+
+// East Asian wide and fullwidth characters and emoji
+const Range doubleWidth[] = {
+    { 0x1100, 0x115F }, { 0x231A, 0x231B }, { 0x2329, 0x232A }, { 0x23E9, 0x23EC },
+    { 0x23F0, 0x23F0 }, { 0x23F3, 0x23F3 }, { 0x25FD, 0x25FE }, { 0x2614, 0x2615 },
+    { 0x2648, 0x2653 }, { 0x267F, 0x267F }, { 0x2693, 0x2693 }, { 0x26A1, 0x26A1 },
+    { 0x26AA, 0x26AB }, { 0x26BD, 0x26BE }, { 0x26C4, 0x26C5 }, { 0x26CE, 0x26CE },
+    { 0x26D4, 0x26D4 }, { 0x26EA, 0x26EA }, { 0x26F2, 0x26F3 }, { 0x26F5, 0x26F5 },
+    { 0x26FA, 0x26FA }, { 0x26FD, 0x26FD }, { 0x2705, 0x2705 }, { 0x270A, 0x270B },
+    { 0x2728, 0x2728 }, { 0x274C, 0x274C }, { 0x274E, 0x274E }, { 0x2753, 0x2755 },
+    { 0x2757, 0x2757 }, { 0x2795, 0x2797 }, { 0x27B0, 0x27B0 }, { 0x27BF, 0x27BF },
+    { 0x2B1B, 0x2B1C }, { 0x2B50, 0x2B50 }, { 0x2B55, 0x2B55 }, { 0x2E80, 0x303E },
+    { 0x3041, 0x33FF }, { 0x3400, 0x4DBF }, { 0x4E00, 0x9FFF }, { 0xA000, 0xA4CF },
+    { 0xA960, 0xA97F }, { 0xAC00, 0xD7A3 }, { 0xF900, 0xFAFF }, { 0xFE10, 0xFE19 },
+    { 0xFE30, 0xFE6F }, { 0xFF00, 0xFF60 }, { 0xFFE0, 0xFFE6 }, { 0x16FE0, 0x16FE4 },
+    { 0x17000, 0x18AFF }, { 0x1B000, 0x1B2FF }, { 0x1F004, 0x1F004 }, { 0x1F0CF, 0x1F0CF },
+    { 0x1F18E, 0x1F18E }, { 0x1F191, 0x1F19A }, { 0x1F200, 0x1F251 }, { 0x1F300, 0x1F64F },
+    { 0x1F680, 0x1F6FF }, { 0x1F7E0, 0x1F7EB }, { 0x1F90C, 0x1F9FF }, { 0x1FA70, 0x1FAFF },
+    { 0x20000, 0x2FFFD }, { 0x30000, 0x3FFFD },
+};
+
+template <size_t N>
+bool inRanges(const Range (&ranges)[N], uint32_t cp)
+{
+    const Range* r = upper_bound(ranges, ranges + N, cp,
+        [](uint32_t c, const Range& range) { return c < range.first; });
+    return r != ranges && cp <= (r - 1)->last;
+}
+} // namespace
+
+namespace Utf8 {
+
+size_t decode(const char* s, size_t n, size_t i, uint32_t& cp)
+{
+    unsigned char c = s[i];
+    if (c < 0x80) {
+        cp = c;
+        return 1;
+    }
+
+    size_t length;
+    uint32_t min;
+    if ((c & 0xE0) == 0xC0) {
+        length = 2;
+        cp = c & 0x1F;
+        min = 0x80;
+    } else if ((c & 0xF0) == 0xE0) {
+        length = 3;
+        cp = c & 0x0F;
+        min = 0x800;
+    } else if ((c & 0xF8) == 0xF0) {
+        length = 4;
+        cp = c & 0x07;
+        min = 0x10000;
+    } else {
+        return 0; // A continuation byte or 0xF8 and up
+    }
+    if (n - i < length) {
+        return 0;
+    }
+    for (size_t k = 1; k < length; k++) {
+        if (!continuation(s[i + k]))
+            return 0;
+        cp = (cp << 6) | (s[i + k] & 0x3F);
+    }
+
+    // Overlong forms, surrogates and past the last code point aren't valid
+    if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+        return 0;
+    }
+    return length;
+}
+
+int charWidth(uint32_t cp)
+{
+    if (cp < 0x300) {
+        return 1;
+    }
+    if (inRanges(zeroWidth, cp)) {
+        return 0;
+    }
+    return inRanges(doubleWidth, cp) ? 2 : 1;
+}
+
+size_t next(const char* s, size_t n, size_t x)
+{
+    if (x >= n) {
+        return x + 1;
+    }
+    uint32_t cp;
+    size_t length = decode(s, n, x, cp);
+    return x + (length ? length : 1);
+}
+
+size_t prev(const char* s, size_t x)
+{
+    // Back over at most three continuation bytes to where they start
+    size_t start = x - 1;
+    while (start > 0 && x - start < 4 && continuation(s[start])) {
+        start--;
+    }
+    uint32_t cp;
+    if (decode(s, x, start, cp) == x - start) {
+        return start;
+    }
+    return x - 1; // Not a whole character, just a stray byte
+}
+
+uint32_t measure(const char* s, size_t n, bool& valid)
+{
+    valid = true;
+    uint64_t width = 0;
+    for (size_t i = 0; i < n;) {
+        uint32_t cp;
+        size_t length = decode(s, n, i, cp);
+        if (length) {
+            width += charWidth(cp);
+            i += length;
+        } else {
+            valid = false;
+            width++;
+            i++;
+        }
+    }
+    return uint32_t(min(width, uint64_t(UINT32_MAX)));
+}
+
+size_t column(LineView line, size_t x)
+{
+    x = min(x, line.size);
+    if (line.ascii) {
+        return x;
+    }
+    size_t col = 0;
+    for (size_t i = 0; i < x;) {
+        uint32_t cp;
+        size_t length = decode(line.data, line.size, i, cp);
+        col += length ? charWidth(cp) : 1;
+        i += length ? length : 1;
+    }
+    return col;
+}
+
+size_t offsetAt(LineView line, size_t col)
+{
+    if (line.ascii) {
+        return min(col, line.size);
+    }
+    size_t at = 0;
+    for (size_t i = 0; i < line.size;) {
+        uint32_t cp;
+        size_t length = decode(line.data, line.size, i, cp);
+        size_t w = length ? charWidth(cp) : 1;
+        // Stop on the character covering the column, not inside it
+        if (w > 0 && at + w > col) {
+            return i;
+        }
+        at += w;
+        i += length ? length : 1;
+    }
+    return line.size;
+}
+
+void clip(LineView line, size_t cols, string& out)
+{
+    // Most lines are ASCII or at least valid and short enough
+    if (line.ascii || (line.valid && line.width <= cols)) {
+        out.append(line.data, line.ascii ? min(line.size, cols) : line.size);
+        return;
+    }
+
+    size_t used = 0;
+    for (size_t i = 0; i < line.size;) {
+        uint32_t cp;
+        size_t length = decode(line.data, line.size, i, cp);
+        size_t w = length ? charWidth(cp) : 1;
+        if (used + w > cols) {
+            break;
+        }
+        if (length) {
+            out.append(line.data + i, length);
+            i += length;
+        } else {
+            out += '?';
+            i++;
+        }
+        used += w;
+    }
+}
+} // Utf8
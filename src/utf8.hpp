@@ -0,0 +1,109 @@
+// utf8.hpp
+#ifndef UTF8_H
+#define UTF8_H
+
+// UTF-8 text: where characters start and how many columns they take
+//
+// Positions in a line are byte offsets everywhere in the editor, these
+// turn them into characters and screen columns. A byte that isn't part of
+// valid UTF-8 counts as a character of its own, one column wide, and is
+// drawn as '?'.
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "buffer.hpp"
+
+using namespace std;
+
+namespace Utf8 {
+
+// Is c the second, third or fourth byte of a character?
+inline bool continuation(char c)
+{
+    return (c & 0xC0) == 0x80;
+}
+
+// Decode the character at s[i], its length or 0 if it isn't valid
+size_t decode(const char* s, size_t n, size_t i, uint32_t& cp);
+
+// Columns a code point takes on a terminal (0 for combining marks, 2 for
+// wide East Asian characters and emoji)
+int charWidth(uint32_t cp);
+
+// Start of the character after the one at x, and of the one before x
+size_t next(const char* s, size_t n, size_t x);
+size_t prev(const char* s, size_t x);
+
+// Find the end of a line in [p, end) (the newline or end), clearing ascii
+// if a byte on the way has its top bit set
+inline const char* scanLine(const char* p, const char* end, bool& ascii)
+{
+#ifdef __SSE2__
+    // 16 bytes at a time: where the newlines are and whether any byte is
+    // outside ASCII come out of the same load
+    const __m128i newline = _mm_set1_epi8('\n');
+    __m128i high = _mm_setzero_si128();
+    while (end - p >= 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(a, newline));
+        if (mask) {
+            // Only the bytes before the newline belong to the line
+            unsigned int before = (1u << __builtin_ctz(mask)) - 1;
+            if (_mm_movemask_epi8(a) & before)
+                ascii = false;
+            if (_mm_movemask_epi8(high))
+                ascii = false;
+            return p + __builtin_ctz(mask);
+        }
+        high = _mm_or_si128(high, a);
+        p += 16;
+    }
+    if (_mm_movemask_epi8(high))
+        ascii = false;
+#endif
+    for (; p < end && *p != '\n'; p++) {
+        if (*p & 0x80)
+            ascii = false;
+    }
+    return p;
+}
+
+// Are all the bytes ASCII?
+inline bool isAscii(const char* p, size_t n)
+{
+    bool ascii = true;
+    const char* end = p + n;
+#ifdef __SSE2__
+    __m128i high = _mm_setzero_si128();
+    for (; end - p >= 16; p += 16) {
+        high = _mm_or_si128(high, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+    }
+    ascii = !_mm_movemask_epi8(high);
+#endif
+    for (; p < end; p++) {
+        if (*p & 0x80)
+            ascii = false;
+    }
+    return ascii;
+}
+
+// The columns of the text and whether it's all valid UTF-8, for text that
+// isn't ASCII (ASCII takes a column a byte)
+uint32_t measure(const char* s, size_t n, bool& valid);
+
+// Columns taken by the bytes before x
+size_t column(LineView line, size_t x);
+
+// Byte offset of the character at column col, or the end of the line
+size_t offsetAt(LineView line, size_t col);
+
+// Append the characters that fit in cols columns to out, with '?' for the
+// bytes that aren't valid UTF-8 (so byte offsets stay the same)
+void clip(LineView line, size_t cols, string& out);
+} // Utf8
+#endif // UTF8_H
@@ -0,0 +1,106 @@
+/*
+*    TextSoup, Yet another text editor
+*    Copyright (C) 2017  Jyry Hjelt
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*/
+// watch.cpp
+
+// Include the libraries
+#include <errno.h>
+#include <string.h>
+#include <string>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "watch.hpp"
+
+using namespace std;
+
+FileWatch::FileWatch(const string& NAME)
+    : name(NAME)
+{
+    size_t slash = name.rfind('/');
+    string dir = slash == string::npos ? "." : (slash == 0 ? "/" : name.substr(0, slash));
+    base = slash == string::npos ? name : name.substr(slash + 1);
+
+    const uint32_t events = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM
+        | IN_CREATE | IN_DELETE;
+    notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (notify >= 0 && inotify_add_watch(notify, dir.c_str(), events) < 0) {
+        close(notify);
+        notify = -1;
+    }
+    remember();
+}
+
+FileWatch::~FileWatch()
+{
+    if (notify >= 0) {
+        close(notify);
+    }
+}
+
+bool FileWatch::poll()
+{
+    bool was = differs;
+    if (notify < 0) {
+        return !was && check();
+    }
+
+    // Only the events about this file matter, and only whether there were any
+    alignas(inotify_event) char events[4096];
+    bool touched = false;
+    ssize_t n;
+    while ((n = read(notify, events, sizeof(events))) > 0) {
+        for (char* at = events; at < events + n;) {
+            inotify_event* e = reinterpret_cast<inotify_event*>(at);
+            if ((e->len > 0 && base == e->name) || (e->mask & IN_Q_OVERFLOW)) {
+                touched = true;
+            }
+            at += sizeof(inotify_event) + e->len;
+        }
+    }
+    return touched && !was && check();
+}
+
+bool FileWatch::check()
+{
+    differs = !same(look(), known);
+    return differs;
+}
+
+void FileWatch::remember()
+{
+    known = look();
+    differs = false;
+}
+
+FileWatch::Look FileWatch::look() const
+{
+    Look l;
+    struct stat info;
+    if (stat(name.c_str(), &info) == 0) {
+        l.exists = true;
+        l.device = info.st_dev;
+        l.inode = info.st_ino;
+        l.size = info.st_size;
+        l.modified = info.st_mtim;
+    }
+    return l;
+}
+
+bool FileWatch::same(const Look& a, const Look& b)
+{
+    return a.exists == b.exists && a.device == b.device && a.inode == b.inode && a.size == b.size
+        && a.modified.tv_sec == b.modified.tv_sec && a.modified.tv_nsec == b.modified.tv_nsec;
+}
@@ -0,0 +1,48 @@
+// watch.hpp
+#ifndef WATCH_H
+#define WATCH_H
+
+// Noticing when another program changes a file that is open
+#include <string>
+#include <sys/stat.h>
+
+using namespace std;
+
+// Watches the directory of a file with inotify, so a file that's replaced
+// (written under another name and renamed over the old one, like most
+// editors and this one save) is noticed as well as one written in place.
+// What the file looked like is remembered when it's loaded or saved and an
+// event only counts when the file looks different from that, so the
+// editor's own saves and the journal next to the file don't. Without
+// inotify the file is looked at every time poll() is called.
+class FileWatch {
+public:
+    explicit FileWatch(const string& NAME); // Remembers how the file is now
+    ~FileWatch();
+    FileWatch(const FileWatch&) = delete;
+    FileWatch& operator=(const FileWatch&) = delete;
+
+    const string& file() const { return name; }
+    bool poll(); // Read the events, true once when a change is first noticed
+    bool changed() const { return differs; } // Not like it was remembered
+    bool check(); // Look at the file right now, gives changed()
+    void remember(); // The file is like the buffer now (loaded or saved)
+
+private:
+    string name;
+    string base; // The name without its directory, for the events
+    int notify = -1;
+    bool differs = false;
+
+    struct Look {
+        bool exists = false;
+        dev_t device = 0;
+        ino_t inode = 0;
+        off_t size = 0;
+        timespec modified = timespec();
+    } known;
+    Look look() const;
+    static bool same(const Look& a, const Look& b);
+};
+
+#endif // WATCH_H